@@ -0,0 +1,77 @@
+/* arena.c
+ *
+ * Blocks form a singly linked list, newest first, and only the newest is
+ * allocated from.  A request bigger than a quarter block gets a block of
+ * its own, linked in behind the current one, so one long string never
+ * wastes the rest of a half-used block.
+ */
+
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+struct arenablock {
+    arenablock *next;
+    size_t size;           /* of data */
+    char data[];
+};
+
+static const size_t kDefaultBlockSize = 64 * 1024;
+
+void ArenaNew(arena *a, size_t blockSize) {
+    a->blocks = NULL;
+    a->next = NULL;
+    a->left = 0;
+    a->blockSize = (blockSize > 0) ? blockSize : kDefaultBlockSize;
+}
+
+void ArenaDispose(arena *a) {
+    arenablock *b = a->blocks;
+    while (b != NULL) {
+        arenablock *next = b->next;
+        free(b);
+        b = next;
+    }
+    a->blocks = NULL;
+    a->next = NULL;
+    a->left = 0;
+}
+
+static arenablock *NewBlock(size_t size) {
+    arenablock *b = malloc(sizeof(arenablock) + size);
+    assert(b != NULL);
+    b->size = size;
+    return b;
+}
+
+char *ArenaAlloc(arena *a, size_t size) {
+    if (size <= a->left) {
+        char *p = a->next;
+        a->next += size;
+        a->left -= size;
+        return p;
+    }
+    if (size > a->blockSize / 4) {
+        arenablock *b = NewBlock(size);
+        if (a->blocks == NULL) {
+            b->next = NULL;
+            a->blocks = b;
+        } else {
+            b->next = a->blocks->next;
+            a->blocks->next = b;
+        }
+        return b->data;
+    }
+    arenablock *b = NewBlock(a->blockSize);
+    b->next = a->blocks;
+    a->blocks = b;
+    a->next = b->data + size;
+    a->left = b->size - size;
+    return b->data;
+}
+
+char *ArenaStrDup(arena *a, const char *s) {
+    size_t n = strlen(s) + 1;
+    return memcpy(ArenaAlloc(a, n), s, n);
+}
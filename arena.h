@@ -0,0 +1,72 @@
+#ifndef _arena_
+#define _arena_
+
+#include <stddef.h>
+
+/**
+ * Type: arena
+ * -----------
+ * A bump allocator for strings that live exactly as long as something
+ * else does (every url and title of an index, say).  Allocating carves the
+ * next few bytes off the current block, and a fresh block is malloc'd only
+ * when that one runs out, so thousands of strings cost a handful of
+ * mallocs.  Nothing is ever freed individually: ArenaDispose releases the
+ * blocks, and with them every string, in one sweep.
+ *
+ *     arena a;
+ *     ArenaNew(&a, 0);
+ *     const char *url = ArenaStrDup(&a, "http://www.nytimes.com/");
+ *     ...
+ *     ArenaDispose(&a);   // url is gone too
+ *
+ * Strings never move once allocated.  An arena isn't thread-safe.  As with
+ * vector and hashset, the fields are exposed only so an arena can live
+ * inside another structure; pretend they're private.
+ */
+
+typedef struct arenablock arenablock;
+
+typedef struct {
+  arenablock *blocks;   /* most recent first */
+  char *next;           /* free space in blocks */
+  size_t left;
+  size_t blockSize;
+} arena;
+
+/**
+ * Function: ArenaNew
+ * ------------------
+ * Initializes an empty arena that allocates blockSize bytes at a time, or
+ * a sensible default if blockSize is 0.  No memory is allocated until the
+ * first string is.
+ */
+
+void ArenaNew(arena *a, size_t blockSize);
+
+/**
+ * Function: ArenaDispose
+ * ----------------------
+ * Frees every block, invalidating every string the arena handed out.
+ */
+
+void ArenaDispose(arena *a);
+
+/**
+ * Function: ArenaAlloc
+ * --------------------
+ * Returns size bytes of uninitialized, unaligned memory, good until the
+ * arena is disposed of.  Requests too large to share a block get one to
+ * themselves.  Never returns NULL.
+ */
+
+char *ArenaAlloc(arena *a, size_t size);
+
+/**
+ * Function: ArenaStrDup
+ * ---------------------
+ * The arena's strdup: copies s, '\0' and all, into the arena.
+ */
+
+char *ArenaStrDup(arena *a, const char *s);
+
+#endif
@@ -0,0 +1,90 @@
+/* epoch.c
+ *
+ * Retired pointers are pushed onto a lock-free stack (fresh).  Reclaiming
+ * in epoch c takes the whole stack as the batch collected in c, and may
+ * only move on to c + 1 once the readers of c - 1 are gone; by then the
+ * batch collected in c - 1 (before anyone could enter c) can't be in use
+ * by anybody, since readers of c - 2 and earlier had to leave before c
+ * began.  Two batches and two reader counts, indexed by parity, are enough.
+ *
+ * A reader announces itself in the count of the epoch it read, then makes
+ * sure the epoch is still the same: if it moved on meanwhile, the
+ * reclaimer may have missed the announcement, so the reader backs out and
+ * tries again.  Everything the reclaimer and readers share goes through
+ * sequentially consistent atomics.
+ */
+
+#include "epoch.h"
+#include <stdlib.h>
+#include <assert.h>
+
+struct retired {
+    retired *next;
+    void *p;
+};
+
+void EpochNew(epoch *e) {
+    e->current = 0;
+    e->readers[0] = e->readers[1] = 0;
+    e->fresh = NULL;
+    e->pending[0] = e->pending[1] = NULL;
+    pthread_mutex_init(&e->reclaiming, NULL);
+}
+
+static void FreeAll(retired *r) {
+    while (r != NULL) {
+        retired *next = r->next;
+        free(r->p);
+        free(r);
+        r = next;
+    }
+}
+
+void EpochDispose(epoch *e) {
+    FreeAll(e->fresh);
+    FreeAll(e->pending[0]);
+    FreeAll(e->pending[1]);
+    pthread_mutex_destroy(&e->reclaiming);
+}
+
+int EpochEnter(epoch *e) {
+    for (;;) {
+        unsigned long c = __atomic_load_n(&e->current, __ATOMIC_SEQ_CST);
+        int ticket = (int)(c & 1);
+        __atomic_add_fetch(&e->readers[ticket], 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&e->current, __ATOMIC_SEQ_CST) == c) return ticket;
+        __atomic_sub_fetch(&e->readers[ticket], 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+void EpochExit(epoch *e, int ticket) {
+    __atomic_sub_fetch(&e->readers[ticket], 1, __ATOMIC_SEQ_CST);
+}
+
+void EpochRetire(epoch *e, void *p) {
+    if (p == NULL) return;
+    if (e == NULL) {
+        free(p);
+        return;
+    }
+    retired *r = malloc(sizeof(retired));
+    assert(r != NULL);
+    r->p = p;
+    r->next = __atomic_load_n(&e->fresh, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&e->fresh, &r->next, r, 1,   /* weak */
+                                        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        ;
+}
+
+void EpochReclaim(epoch *e) {
+    if (pthread_mutex_trylock(&e->reclaiming) != 0) return;
+    unsigned long c = __atomic_load_n(&e->current, __ATOMIC_SEQ_CST);
+    int previous = (int)((c + 1) & 1);   /* parity of c - 1 */
+    if (__atomic_load_n(&e->readers[previous], __ATOMIC_SEQ_CST) == 0) {
+        FreeAll(e->pending[previous]);
+        e->pending[previous] = NULL;
+        e->pending[c & 1] = __atomic_exchange_n(&e->fresh, NULL, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&e->current, c + 1, __ATOMIC_SEQ_CST);
+    }
+    pthread_mutex_unlock(&e->reclaiming);
+}
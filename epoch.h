@@ -0,0 +1,92 @@
+#ifndef _epoch_
+#define _epoch_
+
+#include <pthread.h>
+
+/**
+ * Type: epoch
+ * -----------
+ * Deferred freeing for structures that readers walk without taking any
+ * lock while a writer keeps growing them.  A writer that replaces an array
+ * (with a bigger copy, say) can't free the old one on the spot, since a
+ * reader may be halfway through it; it hands the array to EpochRetire
+ * instead, and it's freed once every reader that could have seen it has
+ * left.
+ *
+ *     int ticket = EpochEnter(&e);      // reader
+ *     ... follow pointers, read arrays ...
+ *     EpochExit(&e, ticket);
+ *
+ *     ... publish the new array, then ...
+ *     EpochRetire(&e, old);             // writer
+ *     EpochReclaim(&e);                 // now and then
+ *
+ * Readers only ever touch two shared counters, and retiring never blocks.
+ * Time is cut into epochs: readers register with the current one, and the
+ * epoch moves on (freeing what was retired two epochs back) only once
+ * nobody is left in the one before it.  So a reader that stays inside for
+ * a long time delays freeing, but never anything else.  Pretend the fields
+ * are private.
+ */
+
+typedef struct retired retired;
+
+typedef struct {
+    unsigned long current;
+    long readers[2];              /* inside, by parity of the epoch joined */
+    retired *fresh;               /* retired since the last EpochReclaim */
+    retired *pending[2];          /* by parity of the epoch collected in */
+    pthread_mutex_t reclaiming;
+} epoch;
+
+/**
+ * Function: EpochNew
+ * ------------------
+ * Initializes e with no readers and nothing retired.
+ */
+
+void EpochNew(epoch *e);
+
+/**
+ * Function: EpochDispose
+ * ----------------------
+ * Frees everything still retired.  No reader may be inside.
+ */
+
+void EpochDispose(epoch *e);
+
+/**
+ * Function: EpochEnter, EpochExit
+ * -------------------------------
+ * Bracket a reader's use of shared structures: nothing retired after
+ * EpochEnter returns is freed before the matching EpochExit, which must be
+ * passed the ticket EpochEnter returned.  Any number of threads can be
+ * inside at once.
+ */
+
+int EpochEnter(epoch *e);
+void EpochExit(epoch *e, int ticket);
+
+/**
+ * Function: EpochRetire
+ * ---------------------
+ * Arranges for p, which must already be unreachable for readers that
+ * haven't yet entered, to be freed once the readers inside now have all
+ * left.  Safe to call from any thread.  With a NULL e, p is freed at once,
+ * which lets code serve both shared and private structures.
+ */
+
+void EpochRetire(epoch *e, void *p);
+
+/**
+ * Function: EpochReclaim
+ * ----------------------
+ * Moves to the next epoch if no reader is left in the previous one,
+ * freeing whatever can no longer be in use.  Never waits for readers, so
+ * it's cheap enough to call after every update; if another thread is
+ * already reclaiming it simply returns.
+ */
+
+void EpochReclaim(epoch *e);
+
+#endif
@@ -0,0 +1,53 @@
+#!/usr/bin/env python3
+#
+# Local stand-in for the HTTP servers feeds and articles come from, for
+# testing conditional polling (-u) without the network:
+#
+#     python3 feed-standin.py port directory
+#
+# serves the files under directory on 127.0.0.1:port.  Every response
+# carries an ETag made from the file's contents, and a request whose
+# If-None-Match matches it gets 304 Not Modified and no body.  A request for
+# a file that doesn't exist is answered by hanging up, as a server that's
+# down would, so that a test can make an article's download fail and then
+# have the article appear.  (A 404 would be no good: like any other page,
+# it's a successful download as far as the fetcher is concerned.)
+
+import hashlib
+import os
+import sys
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+
+class Handler(BaseHTTPRequestHandler):
+    root = "."
+
+    def do_GET(self):
+        path = os.path.join(self.root, self.path.split("?")[0].lstrip("/"))
+        try:
+            with open(path, "rb") as f:
+                body = f.read()
+        except OSError:
+            self.close_connection = True
+            return
+        etag = '"%s"' % hashlib.sha1(body).hexdigest()
+        if self.headers.get("If-None-Match") == etag:
+            self.send_response(304)
+            self.send_header("ETag", etag)
+            self.end_headers()
+            return
+        self.send_response(200)
+        self.send_header("ETag", etag)
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def log_message(self, format, *args):
+        sys.stderr.write("feed-standin: %s %s\n" % (self.requestline, args[1]))
+
+
+if __name__ == "__main__":
+    if len(sys.argv) != 3:
+        sys.exit("Usage: %s port directory" % sys.argv[0])
+    Handler.root = sys.argv[2]
+    ThreadingHTTPServer(("127.0.0.1", int(sys.argv[1])), Handler).serve_forever()
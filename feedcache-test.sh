@@ -0,0 +1,68 @@
+#!/bin/sh
+#
+# Checks conditional polling end to end against feed-standin.py: a feed
+# whose article couldn't be downloaded must be fetched whole again by the
+# next -u run, which then indexes the article, and a feed that hasn't
+# changed since must be skipped by the one after that.  Run from this
+# directory (like the benchmarks, it needs data/), after building:
+#
+#     make feedcache-test
+#
+# RSS_NEWS_SEARCH and PORT override the binary and the stand-in's port.
+
+BIN=${RSS_NEWS_SEARCH:-./rss-news-search}
+PORT=${PORT:-8642}
+HERE=$(cd "$(dirname "$0")" && pwd)
+
+dir=$(mktemp -d)
+mkdir "$dir/site"
+python3 "$HERE/feed-standin.py" "$PORT" "$dir/site" 2> "$dir/standin.log" &
+server=$!
+trap 'kill $server 2> /dev/null; rm -rf "$dir"' EXIT
+
+fail() {
+  echo "FAIL: $1 (output in $dir/out$2.txt)"
+  trap 'kill $server 2> /dev/null' EXIT
+  exit 1
+}
+
+article() {
+  echo "<html><body><p>Story $1 is about feed number $1.</p></body></html>" \
+    > "$dir/site/a$1.html"
+}
+
+{
+  echo '<?xml version="1.0"?><rss><channel><title>Test</title>'
+  for a in 1 2 3; do
+    echo "<item><title>Story $a</title><link>http://127.0.0.1:$PORT/a$a.html</link></item>"
+  done
+  echo '</channel></rss>'
+} > "$dir/site/feed.xml"
+echo "Test: http://127.0.0.1:$PORT/feed.xml" > "$dir/feeds.txt"
+article 1
+article 2    # a3.html is missing until the second poll
+
+poll() {
+  printf '\n' | "$BIN" -u "$dir/news.idx" "$dir/feeds.txt" > "$dir/out$1.txt" 2>&1 ||
+    fail "run $1 exited with status $?" "$1"
+}
+
+sleep 1    # let the stand-in start listening
+poll 1
+grep -q 'Unable to fetch URL: .*a3\.html' "$dir/out1.txt" ||
+  fail "the first poll should fail to fetch a3.html" 1
+
+article 3
+poll 2
+grep -q 'unchanged since the last poll' "$dir/out2.txt" &&
+  fail "the second poll treated a feed with a missing article as unchanged" 2
+grep -q 'Scanning "Story 3"' "$dir/out2.txt" ||
+  fail "the second poll should index the article that failed" 2
+
+poll 3
+grep -q '^1 feed unchanged since the last poll' "$dir/out3.txt" ||
+  fail "the third poll should skip the unchanged feed" 3
+grep -q 'Scanning' "$dir/out3.txt" &&
+  fail "the third poll shouldn't index anything" 3
+
+echo "PASS: conditional polling"
@@ -0,0 +1,131 @@
+/* feedcache.c
+ *
+ * Entries live in a hashset keyed by URL.  The hashset can't delete, so a
+ * forgotten URL keeps an entry with no validators, which lookups and saves
+ * treat as missing.  The file has one line per URL, holding the URL, the
+ * ETag and the Last-Modified date separated by tabs (an empty field for a
+ * missing validator); header values can't contain tabs or newlines.
+ */
+
+#include "feedcache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+typedef struct {
+    char *url;
+    char *etag;              /* NULL if the server sent none */
+    char *lastModified;
+} feedentry;
+
+static const int kNumBuckets = 1009;
+
+static int EntryHash(const void *elemAddr, int numBuckets) {
+    const char *s = ((const feedentry *)elemAddr)->url;
+    unsigned long hash = 5381;  /* djb2 */
+    while (*s != '\0') hash = hash * 33 + (unsigned char)*s++;
+    return (int)(hash % numBuckets);
+}
+
+static int EntryCompare(const void *elemAddr1, const void *elemAddr2) {
+    return strcmp(((const feedentry *)elemAddr1)->url, ((const feedentry *)elemAddr2)->url);
+}
+
+static void EntryFree(void *elemAddr) {
+    feedentry *e = elemAddr;
+    free(e->url);
+    free(e->etag);
+    free(e->lastModified);
+}
+
+void FeedCacheNew(feedcache *c) {
+    HashSetNew(&c->entries, sizeof(feedentry), kNumBuckets, EntryHash, EntryCompare,
+               EntryFree);
+}
+
+void FeedCacheDispose(feedcache *c) {
+    HashSetDispose(&c->entries);
+}
+
+static char *CopyOrNull(const char *s) {
+    if (s == NULL || *s == '\0') return NULL;
+    char *copy = strdup(s);
+    assert(copy != NULL);
+    return copy;
+}
+
+void FeedCacheStore(feedcache *c, const char *url, const char *etag,
+                    const char *lastModified) {
+    feedentry e;
+    e.url = strdup(url);
+    assert(e.url != NULL);
+    e.etag = CopyOrNull(etag);
+    e.lastModified = CopyOrNull(lastModified);
+    HashSetEnter(&c->entries, &e);
+}
+
+bool FeedCacheLookup(feedcache *c, const char *url, const char **etag,
+                     const char **lastModified) {
+    feedentry key = { (char *)url, NULL, NULL };
+    const feedentry *e = HashSetLookup(&c->entries, &key);
+    if (e == NULL || (e->etag == NULL && e->lastModified == NULL)) return false;
+    *etag = e->etag;
+    *lastModified = e->lastModified;
+    return true;
+}
+
+bool FeedCacheLoad(feedcache *c, const char *path) {
+    FILE *in = fopen(path, "r");
+    if (in == NULL) return false;
+    char *line = NULL;
+    size_t allocated = 0;
+    ssize_t length;
+    while ((length = getline(&line, &allocated, in)) > 0) {
+        if (line[length - 1] == '\n') line[length - 1] = '\0';
+        char *etag = strchr(line, '\t');
+        char *lastModified = (etag != NULL) ? strchr(etag + 1, '\t') : NULL;
+        if (lastModified == NULL || etag == line) continue;  /* malformed */
+        *etag++ = '\0';
+        *lastModified++ = '\0';
+        FeedCacheStore(c, line, etag, lastModified);
+    }
+    free(line);
+    fclose(in);
+    return true;
+}
+
+typedef struct {
+    FILE *out;
+    bool ok;
+} savestate;
+
+static void SaveEntry(void *elemAddr, void *auxData) {
+    const feedentry *e = elemAddr;
+    savestate *state = auxData;
+    if (e->etag == NULL && e->lastModified == NULL) return;
+    if (fprintf(state->out, "%s\t%s\t%s\n", e->url, e->etag ? e->etag : "",
+                e->lastModified ? e->lastModified : "") < 0)
+        state->ok = false;
+}
+
+bool FeedCacheSave(feedcache *c, const char *path) {
+    /* written beside path and renamed over it, like index snapshots */
+    size_t n = strlen(path);
+    char *temporary = malloc(n + sizeof(".tmp"));
+    if (temporary == NULL) return false;
+    memcpy(temporary, path, n);
+    memcpy(temporary + n, ".tmp", sizeof(".tmp"));
+
+    savestate state = { fopen(temporary, "w"), true };
+    if (state.out == NULL) {
+        free(temporary);
+        return false;
+    }
+    HashSetMap(&c->entries, SaveEntry, &state);
+    if (fclose(state.out) != 0) state.ok = false;
+    if (state.ok) state.ok = rename(temporary, path) == 0;
+    if (!state.ok) remove(temporary);
+    free(temporary);
+    return state.ok;
+}
@@ -0,0 +1,58 @@
+#ifndef _feedcache_
+#define _feedcache_
+
+#include "hashset.h"     /* first: vector.h's bool must precede stdbool.h */
+#include <stdbool.h>
+
+/**
+ * Type: feedcache
+ * ---------------
+ * Remembers, for each feed URL, the validators (the ETag and Last-Modified
+ * response headers) of the last copy downloaded, so that the next poll can
+ * ask the server for the feed only if it has changed since: see
+ * FetcherSubmitConditional.  A cache is saved to and loaded from a small
+ * text file between runs.  It isn't thread-safe; a fetcher only touches it
+ * from its event thread.  Pretend the fields are private.
+ */
+
+typedef struct {
+    hashset entries;
+} feedcache;
+
+void FeedCacheNew(feedcache *c);
+void FeedCacheDispose(feedcache *c);
+
+/**
+ * Functions: FeedCacheLoad, FeedCacheSave
+ * ---------------------------------------
+ * FeedCacheLoad adds every entry saved in the file at path to c, and
+ * returns false (adding nothing) if the file can't be read.  FeedCacheSave
+ * replaces that file with c's entries, and returns false if it can't.
+ */
+
+bool FeedCacheLoad(feedcache *c, const char *path);
+bool FeedCacheSave(feedcache *c, const char *path);
+
+/**
+ * Function: FeedCacheLookup
+ * -------------------------
+ * Sets *etag and *lastModified to the validators recorded for url, either
+ * of which may be NULL, and returns true, or returns false if there are
+ * none.  The strings belong to c and last until url's entry next changes.
+ */
+
+bool FeedCacheLookup(feedcache *c, const char *url, const char **etag,
+                     const char **lastModified);
+
+/**
+ * Function: FeedCacheStore
+ * ------------------------
+ * Records the validators of the copy of url just downloaded, replacing any
+ * earlier ones.  Either may be NULL; if both are, url is forgotten, since
+ * there's nothing to make the next request conditional on.
+ */
+
+void FeedCacheStore(feedcache *c, const char *url, const char *etag,
+                    const char *lastModified);
+
+#endif
@@ -0,0 +1,431 @@
+/* fetcher.c
+ *
+ * Submitted requests wait on a FIFO per server until the event thread has a
+ * free transfer slot.  Servers take turns: a ring holds every server with
+ * requests waiting and fewer than maxPerHost transfers running, and each
+ * free slot goes to the server at the front, which moves to the back if it
+ * can take another.  A server that's at its limit leaves the ring until one
+ * of its transfers finishes, so however slow it is, it never holds more
+ * than maxPerHost slots.  The event thread owns the multi handle outright:
+ * it adds easy handles, drives them with curl_multi_perform, reaps
+ * completions with curl_multi_info_read, and sleeps in curl_multi_poll.
+ * Other threads only touch the queues (under lock) and poke the event
+ * thread via curl_multi_wakeup.  The multi handle keeps a shared connection
+ * cache (the keep-alive pool, at most maxPerHost connections per server)
+ * and DNS cache, so requests to a server we've already talked to skip the
+ * lookup and the TCP/TLS handshake.  Bodies are accumulated in memory, in a
+ * buffer that doubles whenever curl hands us more than fits, unless the
+ * request is streaming, in which case each piece goes straight to its
+ * chunk function and nothing is kept.  Conditional
+ * requests also watch the response headers for the validators to save.
+ */
+
+#include "fetcher.h"
+#include "url.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <pthread.h>
+#include <curl/curl.h>
+
+typedef struct request {
+    char *url;
+    struct host *host;
+    FetcherDoneFunction done;
+    FetcherChunkFunction chunk;        /* NULL unless streaming */
+    void *aux;
+    char *body;
+    size_t length;
+    size_t capacity;
+    feedcache *cache;                  /* NULL unless conditional */
+    FetcherUnchangedFunction unchanged;
+    struct curl_slist *headers;        /* If-None-Match and so on */
+    char *etag;                        /* response validators, or NULL */
+    char *lastModified;
+    struct request *next;
+} request;
+
+/* A server, as named by URLNewAbsolute, and the requests waiting for it */
+typedef struct host {
+    char *name;
+    request *head;
+    request *tail;
+    int running;                /* admitted and not yet finished */
+    bool ready;                 /* in the ring */
+    struct host *nextReady;
+} host;
+
+struct fetcher {
+    CURLM *multi;
+    pthread_t thread;
+    int maxTransfers;
+    int maxPerHost;
+    int running;                /* easy handles currently in multi (event thread only) */
+
+    pthread_mutex_t lock;
+    pthread_cond_t allDone;     /* signalled when outstanding drops to zero */
+    hashset hosts;              /* host *, by name */
+    host *readyHead;            /* the ring, front to back */
+    host *readyTail;
+    int outstanding;            /* queued + running + in callback */
+    bool shuttingDown;
+};
+
+static const long kDNSCacheSeconds = 600;   /* outlive a full crawl */
+static const size_t kInitialBodyCapacity = 16 * 1024;
+static const int kHostBuckets = 1009;
+
+static int HostHash(const void *elemAddr, int numBuckets) {
+    const char *s = (*(host *const *)elemAddr)->name;
+    unsigned long hash = 5381;  /* djb2, case-folded like host names */
+    while (*s != '\0') hash = hash * 33 + tolower((unsigned char)*s++);
+    return (int)(hash % numBuckets);
+}
+
+static int HostCompare(const void *elemAddr1, const void *elemAddr2) {
+    return strcasecmp((*(host *const *)elemAddr1)->name, (*(host *const *)elemAddr2)->name);
+}
+
+static void HostFree(void *elemAddr) {
+    host *h = *(host **)elemAddr;
+    free(h->name);
+    free(h);
+}
+
+/* Returns the host named name, creating it if need be; f->lock must be held */
+static host *FindHost(fetcher *f, const char *name) {
+    host key = { (char *)name };
+    host *keyAddr = &key;
+    host **found = HashSetLookup(&f->hosts, &keyAddr);
+    if (found != NULL) return *found;
+
+    host *h = malloc(sizeof(host));
+    assert(h != NULL);
+    h->name = strdup(name);
+    assert(h->name != NULL);
+    h->head = h->tail = NULL;
+    h->running = 0;
+    h->ready = false;
+    h->nextReady = NULL;
+    HashSetEnter(&f->hosts, &h);
+    return h;
+}
+
+/* Puts h at the back of the ring if it has requests waiting and room for
+ * another transfer; f->lock must be held */
+static void MaybeReady(fetcher *f, host *h) {
+    if (h->ready || h->head == NULL || h->running >= f->maxPerHost) return;
+    h->ready = true;
+    h->nextReady = NULL;
+    if (f->readyTail != NULL) f->readyTail->nextReady = h; else f->readyHead = h;
+    f->readyTail = h;
+}
+
+/* Takes the next request from the server at the front of the ring, and
+ * sends that server to the back; f->lock must be held */
+static request *TakeNextRequest(fetcher *f) {
+    host *h = f->readyHead;
+    f->readyHead = h->nextReady;
+    if (f->readyHead == NULL) f->readyTail = NULL;
+    h->ready = false;
+
+    request *r = h->head;
+    h->head = r->next;
+    if (h->head == NULL) h->tail = NULL;
+    r->next = NULL;
+    h->running++;
+    MaybeReady(f, h);
+    return r;
+}
+
+static size_t WriteBody(char *ptr, size_t size, size_t nmemb, void *data) {
+    request *r = data;
+    size_t n = size * nmemb;
+    if (r->chunk != NULL) {
+        r->chunk(r->url, ptr, n, r->aux);
+        return n;
+    }
+    if (r->length + n + 1 > r->capacity) {
+        size_t capacity = r->capacity ? r->capacity : kInitialBodyCapacity;
+        while (r->length + n + 1 > capacity) capacity *= 2;
+        char *grown = realloc(r->body, capacity);
+        if (grown == NULL) return 0;   /* makes curl fail the transfer */
+        r->body = grown;
+        r->capacity = capacity;
+    }
+    memcpy(r->body + r->length, ptr, n);
+    r->length += n;
+    return n;
+}
+
+/* If the n bytes of header line are the named header, replaces *value with
+   its trimmed value */
+static void CaptureHeader(const char *line, size_t n, const char *name, char **value) {
+    size_t nameLength = strlen(name);
+    if (n <= nameLength || strncasecmp(line, name, nameLength) != 0 || line[nameLength] != ':')
+        return;
+    const char *start = line + nameLength + 1, *end = line + n;
+    while (start < end && isspace((unsigned char)*start)) start++;
+    while (end > start && isspace((unsigned char)end[-1])) end--;
+    free(*value);
+    *value = strndup(start, end - start);
+}
+
+static size_t ReadHeader(char *line, size_t size, size_t nitems, void *data) {
+    request *r = data;
+    size_t n = size * nitems;
+    if (n >= 5 && strncmp(line, "HTTP/", 5) == 0) {
+        /* the status line of a new response (after a redirect, say) */
+        free(r->etag);
+        free(r->lastModified);
+        r->etag = r->lastModified = NULL;
+    } else {
+        CaptureHeader(line, n, "ETag", &r->etag);
+        CaptureHeader(line, n, "Last-Modified", &r->lastModified);
+    }
+    return n;
+}
+
+static struct curl_slist *AddHeader(struct curl_slist *headers, const char *name,
+                                    const char *value) {
+    char *line = malloc(strlen(name) + strlen(value) + 3);
+    assert(line != NULL);
+    sprintf(line, "%s: %s", name, value);
+    headers = curl_slist_append(headers, line);
+    free(line);
+    return headers;
+}
+
+static void FreeRequest(request *r) {
+    curl_slist_free_all(r->headers);
+    free(r->etag);
+    free(r->lastModified);
+    free(r->url);
+    free(r);
+}
+
+/* Called once a request's callback has returned, to give its transfer
+ * slot to the next request for its server */
+static void RequestFinished(fetcher *f, host *h) {
+    pthread_mutex_lock(&f->lock);
+    h->running--;
+    MaybeReady(f, h);
+    if (--f->outstanding == 0) pthread_cond_broadcast(&f->allDone);
+    pthread_mutex_unlock(&f->lock);
+}
+
+static void StartTransfer(fetcher *f, request *r) {
+    CURL *curl = curl_easy_init();
+    if (curl == NULL) {
+        host *h = r->host;
+        r->done(r->url, NULL, 0, r->aux);
+        FreeRequest(r);
+        RequestFinished(f, h);
+        return;
+    }
+    curl_easy_setopt(curl, CURLOPT_VERBOSE, 0L);
+    curl_easy_setopt(curl, CURLOPT_URL, r->url);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(curl, CURLOPT_DNS_CACHE_TIMEOUT, kDNSCacheSeconds);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteBody);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, r);
+    curl_easy_setopt(curl, CURLOPT_PRIVATE, r);
+    const char *etag, *lastModified;
+    if (r->cache != NULL) {
+        curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, ReadHeader);
+        curl_easy_setopt(curl, CURLOPT_HEADERDATA, r);
+        if (FeedCacheLookup(r->cache, r->url, &etag, &lastModified)) {
+            if (etag != NULL) r->headers = AddHeader(r->headers, "If-None-Match", etag);
+            if (lastModified != NULL)
+                r->headers = AddHeader(r->headers, "If-Modified-Since", lastModified);
+            curl_easy_setopt(curl, CURLOPT_HTTPHEADER, r->headers);
+        }
+    }
+    curl_multi_add_handle(f->multi, curl);
+    f->running++;
+}
+
+static void FinishTransfer(fetcher *f, CURL *curl, CURLcode result) {
+    request *r;
+    long status = 0;
+    curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char **)&r);
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+    curl_multi_remove_handle(f->multi, curl);
+    curl_easy_cleanup(curl);
+    f->running--;
+
+    host *h = r->host;
+    if (r->cache != NULL && result == CURLE_OK && status == 304) {
+        free(r->body);
+        r->unchanged(r->url, r->aux);
+        FreeRequest(r);
+        RequestFinished(f, h);
+        return;
+    }
+    if (r->cache != NULL && result == CURLE_OK && status == 200)
+        FeedCacheStore(r->cache, r->url, r->etag, r->lastModified);
+
+    if (result == CURLE_OK && r->body == NULL)
+        r->body = malloc(1);           /* empty document */
+    if (result != CURLE_OK || r->body == NULL) {
+        free(r->body);
+        r->body = NULL;
+        r->length = 0;
+    } else {
+        r->body[r->length] = '\0';
+    }
+    r->done(r->url, r->body, r->length, r->aux);
+    FreeRequest(r);
+    RequestFinished(f, h);
+}
+
+static void *EventLoop(void *arg) {
+    fetcher *f = arg;
+    while (true) {
+        /* admit queued requests while there are free transfer slots */
+        pthread_mutex_lock(&f->lock);
+        if (f->shuttingDown && f->outstanding == 0) {
+            pthread_mutex_unlock(&f->lock);
+            break;
+        }
+        request *admitted = NULL, **last = &admitted;
+        int slots = f->maxTransfers - f->running;
+        while (slots-- > 0 && f->readyHead != NULL) {
+            *last = TakeNextRequest(f);
+            last = &(*last)->next;
+        }
+        pthread_mutex_unlock(&f->lock);
+
+        while (admitted != NULL) {
+            request *r = admitted;
+            admitted = r->next;
+            StartTransfer(f, r);
+        }
+
+        int stillRunning;
+        curl_multi_perform(f->multi, &stillRunning);
+
+        CURLMsg *msg;
+        int msgsLeft;
+        while ((msg = curl_multi_info_read(f->multi, &msgsLeft)) != NULL) {
+            if (msg->msg == CURLMSG_DONE)
+                FinishTransfer(f, msg->easy_handle, msg->data.result);
+        }
+
+        curl_multi_poll(f->multi, NULL, 0, 1000, NULL);
+    }
+    return NULL;
+}
+
+fetcher *FetcherNew(int maxTransfers, int maxPerHost) {
+    if (maxTransfers <= 0) maxTransfers = 1;
+    if (maxPerHost <= 0) maxPerHost = 1;
+
+    fetcher *f = malloc(sizeof(fetcher));
+    if (!f) return NULL;
+
+    f->multi = curl_multi_init();
+    if (!f->multi) { free(f); return NULL; }
+    curl_multi_setopt(f->multi, CURLMOPT_MAXCONNECTS, (long)maxTransfers);
+    curl_multi_setopt(f->multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)maxPerHost);
+    curl_multi_setopt(f->multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+
+    f->maxTransfers = maxTransfers;
+    f->maxPerHost = maxPerHost;
+    f->running = 0;
+    pthread_mutex_init(&f->lock, NULL);
+    pthread_cond_init(&f->allDone, NULL);
+    HashSetNew(&f->hosts, sizeof(host *), kHostBuckets, HostHash, HostCompare, HostFree);
+    f->readyHead = f->readyTail = NULL;
+    f->outstanding = 0;
+    f->shuttingDown = false;
+
+    if (pthread_create(&f->thread, NULL, EventLoop, f) != 0) {
+        HashSetDispose(&f->hosts);
+        curl_multi_cleanup(f->multi);
+        free(f);
+        return NULL;
+    }
+    return f;
+}
+
+/* The server named by address, as URLNewAbsolute sees it, in a malloc'd copy */
+static char *ServerName(const char *address) {
+    url u;
+    URLNewAbsolute(&u, address);
+    char *name = strdup(u.serverName ? u.serverName : "");
+    assert(name != NULL);
+    URLDispose(&u);
+    return name;
+}
+
+void FetcherSubmit(fetcher *f, const char *url, FetcherDoneFunction done, void *aux) {
+    FetcherSubmitStreaming(f, url, NULL, NULL, done, NULL, aux);
+}
+
+void FetcherSubmitConditional(fetcher *f, const char *url, feedcache *cache,
+                              FetcherDoneFunction done,
+                              FetcherUnchangedFunction unchanged, void *aux) {
+    FetcherSubmitStreaming(f, url, cache, NULL, done, unchanged, aux);
+}
+
+void FetcherSubmitStreaming(fetcher *f, const char *url, feedcache *cache,
+                            FetcherChunkFunction chunk, FetcherDoneFunction done,
+                            FetcherUnchangedFunction unchanged, void *aux) {
+    assert(f != NULL && url != NULL && done != NULL);
+    assert(cache == NULL || unchanged != NULL);
+    request *r = malloc(sizeof(request));
+    assert(r != NULL);
+    r->url = strdup(url);
+    r->done = done;
+    r->chunk = chunk;
+    r->aux = aux;
+    r->body = NULL;
+    r->length = r->capacity = 0;
+    r->cache = cache;
+    r->unchanged = unchanged;
+    r->headers = NULL;
+    r->etag = r->lastModified = NULL;
+    r->next = NULL;
+    char *server = ServerName(url);
+
+    pthread_mutex_lock(&f->lock);
+    host *h = FindHost(f, server);
+    r->host = h;
+    if (h->tail) h->tail->next = r; else h->head = r;
+    h->tail = r;
+    MaybeReady(f, h);
+    f->outstanding++;
+    pthread_mutex_unlock(&f->lock);
+    free(server);
+    curl_multi_wakeup(f->multi);
+}
+
+void FetcherWait(fetcher *f) {
+    pthread_mutex_lock(&f->lock);
+    while (f->outstanding > 0)
+        pthread_cond_wait(&f->allDone, &f->lock);
+    pthread_mutex_unlock(&f->lock);
+}
+
+void FetcherDispose(fetcher *f) {
+    if (f == NULL) return;
+    FetcherWait(f);
+
+    pthread_mutex_lock(&f->lock);
+    f->shuttingDown = true;
+    pthread_mutex_unlock(&f->lock);
+    curl_multi_wakeup(f->multi);
+    pthread_join(f->thread, NULL);
+
+    curl_multi_cleanup(f->multi);
+    HashSetDispose(&f->hosts);
+    pthread_cond_destroy(&f->allDone);
+    pthread_mutex_destroy(&f->lock);
+    free(f);
+}
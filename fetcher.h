@@ -0,0 +1,63 @@
+#ifndef FETCHER_H
+#define FETCHER_H
+
+#include "feedcache.h"
+#include <stddef.h>
+
+/* Event-driven downloader: one thread drives a curl multi handle, so any
+ * number of transfers can be in flight at once while connections and DNS
+ * lookups are reused across requests to the same server. */
+
+/* Called on the fetcher thread once a transfer finishes.  body is a malloc'd
+ * buffer holding the length bytes of the document plus a terminating '\0'
+ * (which length doesn't count), or NULL if the transfer failed; the callee
+ * owns it and must free it.  Callbacks should hand real work off to another
+ * thread rather than block. */
+typedef void (*FetcherDoneFunction)(const char *url, char *body, size_t length,
+                                    void *aux);
+
+/* Opaque fetcher structure */
+typedef struct fetcher fetcher;
+
+/* Lifecycle: at most maxTransfers run at once, and at most maxPerHost of
+ * them on the same server.  The rest wait in FIFO order per server, and
+ * servers with requests waiting take turns at free slots */
+fetcher *FetcherNew(int maxTransfers, int maxPerHost);
+void FetcherDispose(fetcher *f);   /* waits for all transfers first */
+
+/* Queues url for download; done(url, body, aux) fires when it completes */
+void FetcherSubmit(fetcher *f, const char *url, FetcherDoneFunction done, void *aux);
+
+/* Called on the fetcher thread, in place of the done function, when a
+ * conditional request finds the document unchanged (304 Not Modified) */
+typedef void (*FetcherUnchangedFunction)(const char *url, void *aux);
+
+/* Same as FetcherSubmit, except that the request carries If-None-Match and
+ * If-Modified-Since headers built from the validators cache holds for url,
+ * if any, and that a successful response's own validators replace them.
+ * cache is used only on the fetcher thread, and mustn't be touched by any
+ * other thread until FetcherWait returns */
+void FetcherSubmitConditional(fetcher *f, const char *url, feedcache *cache,
+                              FetcherDoneFunction done,
+                              FetcherUnchangedFunction unchanged, void *aux);
+
+/* Called on the fetcher thread with each piece of a streaming request's
+ * body as it arrives.  bytes belongs to the fetcher and is only valid
+ * during the call, which shouldn't block for long: every other transfer
+ * waits on it */
+typedef void (*FetcherChunkFunction)(const char *url, const char *bytes, size_t length,
+                                     void *aux);
+
+/* Same as FetcherSubmitConditional (cache may be NULL), except that if chunk
+ * isn't NULL the body is handed to it piece by piece instead of being
+ * collected: done then gets an empty body on success, or NULL on failure,
+ * which may come after some pieces have been delivered */
+void FetcherSubmitStreaming(fetcher *f, const char *url, feedcache *cache,
+                            FetcherChunkFunction chunk, FetcherDoneFunction done,
+                            FetcherUnchangedFunction unchanged, void *aux);
+
+/* Blocks until every submitted transfer (including ones submitted while
+ * waiting) has completed and its callback has returned */
+void FetcherWait(fetcher *f);
+
+#endif // FETCHER_H
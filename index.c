@@ -5,21 +5,89 @@
  */
 
 #include "index.h"
+#include "arena.h"
+#include "epoch.h"
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
 #include "streamtokenizer.h"
 #include "url.h"
+#include "termdict.h"
+#include "topn.h"
+#include "query.h"
+
+/* Words are split into kNumShards shards by the high bits of their hash,
+   each with a dictionary and postings of its own, so that threads merging
+   different articles with IndexAddArticle mostly lock different shards.
+   Each shard admits one article at a time, in article_id order, which keeps
+   every posting list sorted */
+enum { kShardBits = 4, kNumShards = 1 << kShardBits };
+
+/* Queries read without locking while writers append, so the tables they
+   index into are stablevectors: elements sit in chunks of kChunkSize that
+   never move, found through an array of chunk pointers that's replaced by
+   a bigger copy (the old one retired to the index's epoch) when it fills */
+enum { kChunkBits = 8, kChunkSize = 1 << kChunkBits };
+
+typedef struct {
+    char **chunks;
+    int numChunks;
+    int chunksAllocated;
+    int length;                 /* stored last, once the element is in */
+    int elemSize;
+    VectorFreeFunction freeFn;
+} stablevector;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t turn;        /* broadcast when nextArticle moves on */
+    int nextArticle;            /* the article whose postings go in next */
+    termdict terms;             /* lowercase word -> term id */
+    stablevector entries;       /* WordEntry, indexed by term id */
+} shard;
+
+/* BM25 length norms as of some number of visible articles and tokens;
+   never changed once published, only replaced */
+typedef struct {
+    int numArticles;
+    long numTokens;
+    float min;
+    float norms[];
+} lengthnorms;
 
 struct index {
     hashset stopWords;
-    vector articles;    
-    hashset wordMap;    
+    stablevector articles;      /* Article, by article_id */
+    shard shards[kNumShards];
     
     hashset seen_urls;
     hashset seen_title_server;
+    arena strings;      /* article strings, dedup keys and stop words */
+    pthread_mutex_t articleLock;    /* articles, seen_*, strings, totalTokens,
+                                       and publishing */
+
+    /* what queries see: the articles before the first incomplete one, and
+       their tokens, published together (see Publish) */
+    int visibleArticles;
+    long visibleTokens;
+    unsigned publishing;            /* odd while the two are being changed */
+    epoch reclaim;                  /* arrays queries may still be reading */
+
+    rankingmode rankingMode;
+    long totalTokens;               /* over all articles */
+    lengthnorms *lengthNorms;       /* the latest any query computed */
+
+    const uint8_t *snapshot;        /* mapped by IndexLoad, or NULL */
+    size_t snapshotSize;
+    int numMappedArticles;          /* whose strings point into snapshot */
+    bool mappedArticlesUnseen;      /* not yet in seen_urls and friends */
 };
 
 static const signed long kHashMultiplier = -1664117991L;
@@ -44,51 +112,87 @@ static int CStringCompare(const void *elemAddr1, const void *elemAddr2){
     return strcasecmp(s1, s2); /* case-insensitive */
 }
 
-static void CStringFreeFn(void *elemAddr){
-    char **pp = (char **)elemAddr;
-    if (!pp) return;
-    if (*pp) {
-        free(*pp);
-        *pp = NULL;
-    }
+// for wordEntry
+static void WordEntryFreeFn(void *elemAddr){
+    WordEntry *wrd = (WordEntry *)elemAddr;
+    PostingListDispose(&wrd->postings);
 }
 
-// for wordEntry
-static int WordEntryHash(const void *elemAddr, int numBuckets){
-    WordEntry ** pp = (WordEntry **)elemAddr;
-    const char *s = (*pp)->word;
-    /* reuse CStringHash-style hashing logic but operate on s */
-    unsigned long hashcode = 0UL;
-    for (size_t i = 0; s[i] != '\0'; ++i) {
-        hashcode = hashcode * (unsigned long)kHashMultiplier + (unsigned char)tolower((unsigned char)s[i]);
-    }
-    if (numBuckets <= 0) return 0;
-    return (int)(hashcode % (unsigned long)numBuckets);
+static void StableVectorNew(stablevector *v, int elemSize, VectorFreeFunction freeFn) {
+    v->chunks = NULL;
+    v->numChunks = v->chunksAllocated = 0;
+    v->length = 0;
+    v->elemSize = elemSize;
+    v->freeFn = freeFn;
 }
 
-static int WordEntryCompare(const void *elemAddr1, const void *elemAddr2){
-    WordEntry ** pp1 = (WordEntry **)elemAddr1;
-    WordEntry ** pp2 = (WordEntry **)elemAddr2;
-    const char *a = (*pp1)->word;
-    const char *b = (*pp2)->word;
-    return strcasecmp(a, b); // still case sensitive
+/* Safe alongside StableVectorAppend for any position below a length the
+   caller has seen (through StableVectorLength, or anything published after
+   the element was appended) */
+static void *StableVectorNth(const stablevector *v, int position) {
+    char *const *chunks = __atomic_load_n(&v->chunks, __ATOMIC_ACQUIRE);
+    char *chunk = __atomic_load_n(&chunks[position >> kChunkBits], __ATOMIC_ACQUIRE);
+    return chunk + (size_t)(position & (kChunkSize - 1)) * v->elemSize;
 }
 
-static void WordEntryFreeFn(void *elemAddr){
-    WordEntry **pp = (WordEntry **)elemAddr;
-    WordEntry* wrd = *pp;
-    if (wrd->word) { free(wrd->word); wrd->word = NULL; }
-    VectorDispose(&wrd->postings);
-    free(wrd);
-    *pp = NULL;
+static int StableVectorLength(const stablevector *v) {
+    return __atomic_load_n(&v->length, __ATOMIC_ACQUIRE);
+}
+
+static void StableVectorDispose(stablevector *v) {
+    for (int i = 0; v->freeFn != NULL && i < v->length; i++)
+        v->freeFn(StableVectorNth(v, i));
+    for (int i = 0; i < v->numChunks; i++) free(v->chunks[i]);
+    free(v->chunks);
+}
+
+/* Copies elemAddr in at the end, returning its position.  One writer at a
+   time, who passes the epoch readers are in, if any */
+static int StableVectorAppend(stablevector *v, const void *elemAddr, epoch *reclaim) {
+    int position = v->length;
+    if (position >> kChunkBits == v->numChunks) {
+        if (v->numChunks == v->chunksAllocated) {
+            char **old = v->chunks;
+            v->chunksAllocated = v->chunksAllocated ? 2 * v->chunksAllocated : 16;
+            char **chunks = malloc(v->chunksAllocated * sizeof(char *));
+            assert(chunks != NULL);
+            if (v->numChunks > 0) memcpy(chunks, old, v->numChunks * sizeof(char *));
+            __atomic_store_n(&v->chunks, chunks, __ATOMIC_RELEASE);
+            EpochRetire(reclaim, old);
+        }
+        char *chunk = malloc((size_t)kChunkSize * v->elemSize);
+        assert(chunk != NULL);
+        __atomic_store_n(&v->chunks[v->numChunks++], chunk, __ATOMIC_RELEASE);
+    }
+    memcpy(StableVectorNth(v, position), elemAddr, v->elemSize);
+    __atomic_store_n(&v->length, position + 1, __ATOMIC_RELEASE);
+    return position;
 }
 
-// for article
-static void ArticleFreeFn(void* elem){
-    Article* artc = (Article*)elem;
-    if (artc->url) { free(artc->url); artc->url = NULL; }
-    if (artc->title) { free(artc->title); artc->title = NULL; }
-    if (artc->server) { free(artc->server); artc->server = NULL; }
+/* Makes the first numArticles articles, with numTokens tokens between
+   them, what queries see.  There's only ever one publisher at a time (it
+   holds articleLock, or has the index to itself), and readers retry if
+   they catch it halfway, so the two always go together */
+static void Publish(index_t *idx, int numArticles, long numTokens) {
+    unsigned publishing = idx->publishing;
+    __atomic_store_n(&idx->publishing, publishing + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&idx->visibleArticles, numArticles, __ATOMIC_RELEASE);
+    __atomic_store_n(&idx->visibleTokens, numTokens, __ATOMIC_RELEASE);
+    __atomic_store_n(&idx->publishing, publishing + 2, __ATOMIC_RELEASE);
+}
+
+/* Publishes every article that's complete and follows on from those
+   already published; the caller holds articleLock */
+static void PublishCompleted(index_t *idx) {
+    int numArticles = idx->visibleArticles;
+    long numTokens = idx->visibleTokens;
+    while (numArticles < idx->articles.length) {
+        const Article *art = (const Article *)StableVectorNth(&idx->articles, numArticles);
+        if (!art->complete) break;
+        numTokens += art->numTokens;
+        numArticles++;
+    }
+    if (numArticles != idx->visibleArticles) Publish(idx, numArticles, numTokens);
 }
 
 index_t *IndexCreate(int numBuckets) {
@@ -97,18 +201,44 @@ index_t *IndexCreate(int numBuckets) {
     index_t* ourIndex = malloc(sizeof(index_t));
     if(!ourIndex)return NULL;
 
+    /* every string the index keeps lives in its arena (or, for loaded
+       articles, in the snapshot), so none of these need a free function */
+    ArenaNew(&ourIndex->strings, 0);
+
     /* initialize articles */
-    VectorNew(&ourIndex->articles, sizeof(Article), ArticleFreeFn, 16);
+    StableVectorNew(&ourIndex->articles, sizeof(Article), NULL);
 
     /* stopWords */
-    HashSetNew(&ourIndex->stopWords, sizeof(char*), 1009, CStringHash, CStringCompare, CStringFreeFn);
-
-    /* wordMap stores WordEntry* pointers */
-    HashSetNew(&ourIndex->wordMap, sizeof(WordEntry*), numBuckets, WordEntryHash, WordEntryCompare, WordEntryFreeFn);
+    HashSetNew(&ourIndex->stopWords, sizeof(char*), 1009, CStringHash, CStringCompare, NULL);
+
+    /* term dictionaries, plus the WordEntry of each of their term ids */
+    for (int i = 0; i < kNumShards; i++) {
+        shard *sh = &ourIndex->shards[i];
+        pthread_mutex_init(&sh->lock, NULL);
+        pthread_cond_init(&sh->turn, NULL);
+        sh->nextArticle = 0;
+        TermDictNew(&sh->terms, numBuckets / kNumShards);
+        StableVectorNew(&sh->entries, sizeof(WordEntry), WordEntryFreeFn);
+    }
 
     /* duplicate-detection sets */
-    HashSetNew(&ourIndex->seen_urls, sizeof(char*), 1009, CStringHash, CStringCompare, CStringFreeFn);
-    HashSetNew(&ourIndex->seen_title_server, sizeof(char*), 1009, CStringHash, CStringCompare, CStringFreeFn);
+    HashSetNew(&ourIndex->seen_urls, sizeof(char*), 1009, CStringHash, CStringCompare, NULL);
+    HashSetNew(&ourIndex->seen_title_server, sizeof(char*), 1009, CStringHash, CStringCompare, NULL);
+    pthread_mutex_init(&ourIndex->articleLock, NULL);
+
+    ourIndex->visibleArticles = 0;
+    ourIndex->visibleTokens = 0;
+    ourIndex->publishing = 0;
+    EpochNew(&ourIndex->reclaim);
+
+    ourIndex->rankingMode = kRankByCount;
+    ourIndex->totalTokens = 0;
+    ourIndex->lengthNorms = NULL;
+
+    ourIndex->snapshot = NULL;
+    ourIndex->snapshotSize = 0;
+    ourIndex->numMappedArticles = 0;
+    ourIndex->mappedArticlesUnseen = false;
 
     return ourIndex;
 }
@@ -116,13 +246,24 @@ index_t *IndexCreate(int numBuckets) {
 void IndexDestroy(index_t *idx) {
     if (idx == NULL) return;
 
-    HashSetDispose(&idx->wordMap);
+    for (int i = 0; i < kNumShards; i++) {
+        shard *sh = &idx->shards[i];
+        StableVectorDispose(&sh->entries);
+        TermDictDispose(&sh->terms);
+        pthread_mutex_destroy(&sh->lock);
+        pthread_cond_destroy(&sh->turn);
+    }
 
     HashSetDispose(&idx->stopWords);
     HashSetDispose(&idx->seen_title_server);
     HashSetDispose(&idx->seen_urls);
 
-    VectorDispose(&idx->articles);
+    StableVectorDispose(&idx->articles);
+    ArenaDispose(&idx->strings);
+    pthread_mutex_destroy(&idx->articleLock);
+    free(idx->lengthNorms);
+    EpochDispose(&idx->reclaim);
+    if (idx->snapshot != NULL) munmap((void *)idx->snapshot, idx->snapshotSize);
 
     free(idx);
     idx = NULL;
@@ -138,6 +279,25 @@ static char *StrDupLower(const char *s){
     return out;
 }
 
+/* Scratch space for lowercased lookup keys; tokens that fit (nearly all of
+   them) are never copied to the heap just to be looked up */
+enum { kScratchSize = 256 };
+
+/* Lowercases s into scratch[kScratchSize] if it fits, otherwise into a heap
+   copy.  Returns the lowercased string (NULL if allocation failed); release
+   it with ReleaseLower. */
+static char *LowerInto(char *scratch, const char *s){
+    size_t n = strlen(s);
+    if (n >= kScratchSize) return StrDupLower(s);
+    for (size_t i = 0; i < n; i++) scratch[i] = (char)tolower((unsigned char)s[i]);
+    scratch[n] = '\0';
+    return scratch;
+}
+
+static void ReleaseLower(char *scratch, char *lower){
+    if (lower != scratch) free(lower);
+}
+
 bool IndexLoadStopWords(index_t *idx, const char *stopWordsFile) {
     if (idx == NULL || stopWordsFile == NULL) return false;
 
@@ -150,28 +310,18 @@ bool IndexLoadStopWords(index_t *idx, const char *stopWordsFile) {
     STNew(&st, fp, kNewLineDelimiters, true);
 
     char token[1024];
-    bool ok = true;
     while (STNextToken(&st, token, sizeof(token))) {
         /* Skip empty tokens just in case */
         if (token[0] == '\0') continue;
 
-        /* Lowercase-copy the token (heap-allocated) */
-        char *lower = StrDupLower(token);
-        if (lower == NULL) {
-            ok = false; /* allocation failed */
-            break;
-        }
-
-        char *p = lower;
-        HashSetEnter(&idx->stopWords, &p);
+        /* Lowercase-copy the token into the arena */
+        char *lower = ArenaStrDup(&idx->strings, token);
+        for (char *c = lower; *c != '\0'; c++) *c = (char)tolower((unsigned char)*c);
+        HashSetEnter(&idx->stopWords, &lower);
     }
 
     STDispose(&st);
     fclose(fp);
-
-    if (!ok) {
-        return false;
-    }
     return true;
 }
 
@@ -179,31 +329,47 @@ bool IndexIsStopWord(index_t *idx, const char *word) {
     assert(idx != NULL);
     assert(word != NULL);
 
-    char *lower = StrDupLower(word);
-    if(HashSetLookup(&idx->stopWords, &lower) != NULL){
-        free(lower);
-        return true;
-    }   
-    free(lower);
-    return false;
+    char scratch[kScratchSize];
+    char *lower = LowerInto(scratch, word);
+    if (lower == NULL) return false;
+    bool found = HashSetLookup(&idx->stopWords, &lower) != NULL;
+    ReleaseLower(scratch, lower);
+    return found;
 }
 
 /* ----------------------- Articles -------------------------------------- */
 
-static WordEntry *FindWordEntry(index_t *idx, const char *lowercasedWord);
+static int ShardOf(const char *lowercasedWord, size_t length){
+    return TermDictHash(lowercasedWord, length) >> (32 - kShardBits);
+}
+
+static WordEntry *FindWordEntry(index_t *idx, const char *lowercasedWord){
+    size_t length = strlen(lowercasedWord);
+    shard *sh = &idx->shards[ShardOf(lowercasedWord, length)];
+    int termId = TermDictLookup(&sh->terms, lowercasedWord, length);
+    return (termId < 0) ? NULL : (WordEntry *)StableVectorNth(&sh->entries, termId);
+}
 
 static const char SERVER_TITLE_SEP = '|';
 
-static char *MakeServerTitleKey(const char *server, const char *title) {
+/* Keys are built in scratch space to be looked up, and copied into the
+   arena only when an article is accepted; titles are at most a line of a
+   feed, so keys almost always fit */
+enum { kKeyScratchSize = 2048 };
+
+/* Writes server|title into scratch[kKeyScratchSize] if it fits, otherwise
+   into a heap copy.  Returns the key (NULL if allocation failed); release
+   it with ReleaseLower */
+static char *MakeServerTitleKey(char *scratch, const char *server, const char *title) {
     if (server == NULL) server = "";
     if (title == NULL) title = "";
 
     size_t l1 = strlen(server);
     size_t l2 = strlen(title);
 
-    /* allocate: server + sep + title + NUL */
+    /* server + sep + title + NUL */
     size_t need = l1 + 1 + l2 + 1;
-    char *res = malloc(need);
+    char *res = (need <= kKeyScratchSize) ? scratch : malloc(need);
     if (!res) return NULL;
 
     memcpy(res, server, l1);
@@ -214,139 +380,352 @@ static char *MakeServerTitleKey(const char *server, const char *title) {
     return res;
 }
 
-int IndexRegisterArticle(index_t *idx, const char *para_url, const char *title) {
-    if(idx == NULL || para_url == NULL)return -1;
-    /* --- Step 1: prepare a heap copy of the URL for testing/inserting into seen_urls --- */
-    char *copy_para_url = strdup(para_url);
-    if (!copy_para_url) return -1;
-
-    /* Check seen_urls (lookup expects address of a char*). Use a temp pointer variable. */
-    char *tmp_ptr = copy_para_url;
-    if (HashSetLookup(&idx->seen_urls, &tmp_ptr) != NULL) {
-        /* already seen */
-        free(copy_para_url);
-        return -1;
+/* A snapshot doesn't store the duplicate-detection sets, since they hold
+   nothing but the url and server|title key of every article: they're
+   refilled from the article table the first time they're needed */
+static void RestoreSeenSets(index_t *idx) {
+    if (!idx->mappedArticlesUnseen) return;
+    for (int i = 0; i < idx->numMappedArticles; i++) {
+        const Article *art = (const Article *)StableVectorNth(&idx->articles, i);
+        char scratch[kKeyScratchSize];
+        char *key = MakeServerTitleKey(scratch, art->server, art->title);
+        assert(key != NULL);
+        char *stored = ArenaStrDup(&idx->strings, key);
+        ReleaseLower(scratch, key);
+        HashSetEnter(&idx->seen_urls, &art->url);   /* the mapped copy */
+        HashSetEnter(&idx->seen_title_server, &stored);
     }
+    idx->mappedArticlesUnseen = false;
+}
+
+void IndexPrepareDuplicateChecks(index_t *idx) {
+    if (idx == NULL) return;
+    pthread_mutex_lock(&idx->articleLock);
+    RestoreSeenSets(idx);
+    pthread_mutex_unlock(&idx->articleLock);
+}
+
+bool IndexContainsArticle(index_t *idx, const char *articleURL, const char *title) {
+    if (idx == NULL || articleURL == NULL) return false;
+
+    url u;
+    URLNewAbsolute(&u, articleURL);
+    char scratch[kKeyScratchSize];
+    char *key = MakeServerTitleKey(scratch, u.serverName, title);
+    URLDispose(&u);
+    if (key == NULL) return false;
+
+    const char *lookup = articleURL;
+    pthread_mutex_lock(&idx->articleLock);
+    RestoreSeenSets(idx);
+    bool found = HashSetLookup(&idx->seen_urls, &lookup) != NULL ||
+                 HashSetLookup(&idx->seen_title_server, &key) != NULL;
+    pthread_mutex_unlock(&idx->articleLock);
+    ReleaseLower(scratch, key);
+    return found;
+}
+
+/* Adds an article to the table unless it's a duplicate, and returns its
+   id (or -1).  The url is parsed and the key built before taking the lock,
+   which is then held just long enough to check and update the seen sets
+   and append to the table, so ids come out in registration order */
+static int RegisterArticle(index_t *idx, const char *para_url, const char *title) {
+    if (title == NULL) title = "";
 
     // no server|title dublicates
     url u;
     URLNewAbsolute(&u, para_url); 
     const char *serverName = u.serverName ? u.serverName : "";
 
-    char* key = MakeServerTitleKey(serverName, title ? title : "");
+    char scratch[kKeyScratchSize];
+    char *key = MakeServerTitleKey(scratch, serverName, title);
     if(key == NULL){
         URLDispose(&u);
-        free(copy_para_url);
         return -1;
     }
 
-    char* tmp_key = key;
-    if(HashSetLookup(&idx->seen_title_server, &tmp_key) != NULL){
-        free(key);
-        free(copy_para_url);
-        URLDispose(&u);
-        return -1;
-    }
-    HashSetEnter(&idx->seen_urls, &copy_para_url);
-    HashSetEnter(&idx->seen_title_server, &key);
-    
-    // it got accepted
-    Article art;
-    art.url = strdup(para_url);                      /* Article must own its own copy */
-    art.title = strdup(title ? title : "");
-    art.server = strdup(serverName);   
-
-    if (!art.url || !art.title || !art.server) {
-        if (art.url) free(art.url);
-        if (art.title) free(art.title);
-        if (art.server) free(art.server);
-        URLDispose(&u);
-        return -1;
+    /* Check seen_urls (lookup expects address of a char*). */
+    const char *lookup = para_url;
+    int article_ID = -1;
+    pthread_mutex_lock(&idx->articleLock);
+    RestoreSeenSets(idx);
+    if(HashSetLookup(&idx->seen_urls, &lookup) == NULL &&
+       HashSetLookup(&idx->seen_title_server, &key) == NULL){
+        // it got accepted: its strings are copied into the arena, seen_urls
+        // shares the article's url, and its title is the tail of its key
+        Article art;
+        char *storedKey = ArenaStrDup(&idx->strings, key);
+        art.url = ArenaStrDup(&idx->strings, para_url);
+        art.title = storedKey + strlen(serverName) + 1;
+        art.server = ArenaStrDup(&idx->strings, serverName);
+        art.numTokens = 0;
+        art.complete = false;
+
+        HashSetEnter(&idx->seen_urls, &art.url);
+        HashSetEnter(&idx->seen_title_server, &storedKey);
+        article_ID = StableVectorAppend(&idx->articles, &art, &idx->reclaim);
     }
-    VectorAppend(&idx->articles, &art); // took ownership
-
-    int article_ID = VectorLength(&idx->articles) - 1;
+    pthread_mutex_unlock(&idx->articleLock);
+    ReleaseLower(scratch, key);
     URLDispose(&u);
+    return article_ID;
+}
 
+int IndexRegisterArticle(index_t *idx, const char *para_url, const char *title) {
+    if(idx == NULL || para_url == NULL)return -1;
+    int article_ID = RegisterArticle(idx, para_url, title);
+    if (article_ID < 0) return -1;
+
+    /* this article's tokens come one at a time from the caller, who won't
+       be merging anything else meanwhile, so as far as IndexAddArticle is
+       concerned it's already done with every shard, and as far as queries
+       are concerned it's complete (nobody queries while tokens go in this
+       way) */
+    for (int i = 0; i < kNumShards; i++) {
+        shard *sh = &idx->shards[i];
+        pthread_mutex_lock(&sh->lock);
+        sh->nextArticle = article_ID + 1;
+        pthread_mutex_unlock(&sh->lock);
+    }
+    pthread_mutex_lock(&idx->articleLock);
+    ((Article *)StableVectorNth(&idx->articles, article_ID))->complete = true;
+    PublishCompleted(idx);
+    pthread_mutex_unlock(&idx->articleLock);
+    EpochReclaim(&idx->reclaim);
     return article_ID;
 }
 
+/* An article's strings never change once it's registered, so these are
+   safe alongside insertions */
 const char *IndexGetArticleTitle(index_t *idx, int article_id) {
-    if(idx == NULL || article_id < 0 || article_id >= VectorLength(&idx->articles))return NULL;
-    Article* art = (Article *)VectorNth(&idx->articles, article_id);
+    if(idx == NULL || article_id < 0 || article_id >= StableVectorLength(&idx->articles))return NULL;
+    Article* art = (Article *)StableVectorNth(&idx->articles, article_id);
     return art->title;
 }
 
 
 const char *IndexGetArticleURL(index_t *idx, int article_id) {
-    if(idx == NULL || article_id < 0 || article_id >= VectorLength(&idx->articles))return NULL;
-    Article* art = (Article *)VectorNth(&idx->articles, article_id);
+    if(idx == NULL || article_id < 0 || article_id >= StableVectorLength(&idx->articles))return NULL;
+    Article* art = (Article *)StableVectorNth(&idx->articles, article_id);
     return art->url;
 }
 
 /* ----------------------- Token insertion -------------------------------- */
 
 void IndexAddToken(index_t *idx, int article_id, const char *token) {
-    if(idx == NULL || token == NULL || article_id < 0 || article_id >= VectorLength(&idx->articles)){
+    IndexAddTokenCount(idx, article_id, token, 1);
+}
+
+/* Adds a posting for count occurrences of the lowercased word in
+   article_id to sh, which the caller has locked or has to itself */
+static void AddPosting(index_t *idx, shard *sh, const char *lower, size_t length,
+                       int article_id, int count) {
+    int termId = TermDictLookup(&sh->terms, lower, length);
+    if(termId < 0){
+        /* the entry goes in first: queries can look the word up as soon
+           as it's in the dictionary */
+        WordEntry fresh;
+        PostingListNew(&fresh.postings);
+        termId = StableVectorAppend(&sh->entries, &fresh, &idx->reclaim);
+        bool added;
+        int interned = TermDictInternShared(&sh->terms, lower, length, &added, &idx->reclaim);
+        assert(interned == termId && added);
+        (void)interned;    /* under NDEBUG */
+    }
+    WordEntry *we = (WordEntry *)StableVectorNth(&sh->entries, termId);
+
+    /* articles are indexed one after another in increasing id order, so if
+       this article already has a posting for the word, it's the last one:
+       the list keeps that one unencoded so this is O(1) either way */
+    PostingListAddShared(&we->postings, article_id, count, &idx->reclaim);
+}
+
+void IndexAddTokenCount(index_t *idx, int article_id, const char *token, int count) {
+    if(idx == NULL || token == NULL || count <= 0 || article_id < 0 || article_id >= StableVectorLength(&idx->articles)){
         return;
     }
 
-    char* lower = StrDupLower(token);
+    /* lowercase into scratch space: a brand new word is copied only into the
+       term dictionary's arena */
+    char scratch[kScratchSize];
+    char* lower = LowerInto(scratch, token);
     if(lower == NULL)return;
     
     char *stop_lookup = lower;
     if(HashSetLookup(&idx->stopWords, &stop_lookup) != NULL){
-        free(lower);
+        ReleaseLower(scratch, lower);
         return;
     }
 
-    WordEntry temp;
-    temp.word = lower;
-    WordEntry *tempPtr = &temp; 
+    Article *art = (Article *)StableVectorNth(&idx->articles, article_id);
+    art->numTokens += count;
+    idx->totalTokens += count;
+    if (article_id < idx->visibleArticles)
+        Publish(idx, idx->visibleArticles, idx->visibleTokens + count);
 
-    void* find = HashSetLookup(&idx->wordMap, &tempPtr);
+    size_t length = strlen(lower);
+    AddPosting(idx, &idx->shards[ShardOf(lower, length)], lower, length, article_id, count);
+    ReleaseLower(scratch, lower);
+}
 
-    WordEntry *we = NULL;
-    if(find == NULL){
-        we = malloc(sizeof(WordEntry));
-        if (we == NULL) { free(lower); return; }
-        we->word = lower;
-        VectorNew(&we->postings, sizeof(Posting), NULL, 16);
-        WordEntry *tmp = we; HashSetEnter(&idx->wordMap, &tmp);
-    } else {
-        WordEntry **stored = (WordEntry **)find;
-        we = *stored;
-        /* lower was only for lookup; we don't need it any more */
-        free(lower);
-    }
+/* An article's terms, lowercased and grouped by shard before any shard
+   is locked */
+typedef struct {
+    const char *term;
+    size_t length;
+    int count;
+    int shard;
+} pendingterm;
+
+typedef struct {
+    index_t *idx;
+    arena *text;                /* the lowercased terms */
+    pendingterm *terms;
+    int numTerms;
+    int numTokens;              /* stop words excluded */
+} pendingarticle;
+
+static void CollectTerm(const termcount *entry, void *aux) {
+    pendingarticle *pa = aux;
+    char *lower = ArenaAlloc(pa->text, entry->length + 1);
+    for (uint32_t i = 0; i < entry->length; i++)
+        lower[i] = (char)tolower((unsigned char)entry->term[i]);
+    lower[entry->length] = '\0';
+    if (HashSetLookup(&pa->idx->stopWords, &lower) != NULL) return;
+
+    pendingterm *pt = &pa->terms[pa->numTerms++];
+    pt->term = lower;
+    pt->length = entry->length;
+    pt->count = entry->count;
+    pt->shard = ShardOf(lower, entry->length);
+    pa->numTokens += entry->count;
+}
 
-    for(int i=0; i<VectorLength(&we->postings); i++){
-        Posting* pst = (Posting*)VectorNth(&we->postings, i);
-        if(pst->article_id == article_id){
-            pst->count++;
-            return;
-        }
+int IndexAddArticle(index_t *idx, const char *url, const char *title,
+                    const termcounts *terms) {
+    if (idx == NULL || url == NULL || terms == NULL) return -1;
+    int article_id = RegisterArticle(idx, url, title);
+    if (article_id < 0) return -1;
+
+    arena text;
+    ArenaNew(&text, 0);
+    int numTerms = TermCountsSize(terms);
+    pendingarticle pa = { idx, &text, malloc((numTerms + 1) * sizeof(pendingterm)), 0, 0 };
+    pendingterm *byShard = malloc((numTerms + 1) * sizeof(pendingterm));
+    assert(pa.terms != NULL && byShard != NULL);
+    TermCountsMap(terms, CollectTerm, &pa);
+
+    int start[kNumShards + 1] = { 0 };   /* counting sort by shard */
+    for (int i = 0; i < pa.numTerms; i++) start[pa.terms[i].shard + 1]++;
+    for (int s = 0; s < kNumShards; s++) start[s + 1] += start[s];
+    int fill[kNumShards];
+    memcpy(fill, start, sizeof(fill));
+    for (int i = 0; i < pa.numTerms; i++) byShard[fill[pa.terms[i].shard]++] = pa.terms[i];
+
+    /* visit every shard, even those that get no postings, since the next
+       article waits for this one to pass; starting at a different shard
+       for each article spreads the threads out */
+    for (int k = 0; k < kNumShards; k++) {
+        int s = (article_id + k) % kNumShards;
+        shard *sh = &idx->shards[s];
+        pthread_mutex_lock(&sh->lock);
+        while (sh->nextArticle != article_id)
+            pthread_cond_wait(&sh->turn, &sh->lock);
+        for (int i = start[s]; i < start[s + 1]; i++)
+            AddPosting(idx, sh, byShard[i].term, byShard[i].length, article_id, byShard[i].count);
+        sh->nextArticle = article_id + 1;
+        pthread_cond_broadcast(&sh->turn);
+        pthread_mutex_unlock(&sh->lock);
     }
-    
-    Posting newpost;
-    newpost.article_id = article_id;
-    newpost.count = 1;
-    VectorAppend(&we->postings, &newpost);
+
+    /* queries see it once every article before it is complete too */
+    pthread_mutex_lock(&idx->articleLock);
+    Article *art = (Article *)StableVectorNth(&idx->articles, article_id);
+    art->numTokens += pa.numTokens;
+    art->complete = true;
+    idx->totalTokens += pa.numTokens;
+    PublishCompleted(idx);
+    pthread_mutex_unlock(&idx->articleLock);
+    EpochReclaim(&idx->reclaim);
+
+    free(byShard);
+    free(pa.terms);
+    ArenaDispose(&text);
+    return article_id;
 }
 
 /* ----------------------- Query ----------------------------------------- */
 
-static int result_t_compare(const void *elemAddr1, const void *elemAddr2){
-    const result_t *r1 = (const result_t *)elemAddr1;
-    const result_t *r2 = (const result_t *)elemAddr2;
+/* Ranking (score descending, then smaller article_id first) lives in topn.c */
 
-    /* primary: count descending */
-    if (r2->count != r1->count) return r2->count - r1->count;
+void IndexSetRanking(index_t *idx, rankingmode mode) {
+    idx->rankingMode = mode;
+}
 
-    /* tie-break: smaller article_id first */
-    return r1->article_id - r2->article_id;
+/* What a query sees: the articles published when it began, and their
+   tokens.  Until EndRead, nothing it can reach from there is freed */
+typedef struct {
+    int ticket;
+    int numArticles;
+    long numTokens;
+} readview;
+
+static void BeginRead(index_t *idx, readview *rv) {
+    rv->ticket = EpochEnter(&idx->reclaim);
+    for (;;) {   /* see Publish */
+        unsigned publishing = __atomic_load_n(&idx->publishing, __ATOMIC_ACQUIRE);
+        rv->numArticles = __atomic_load_n(&idx->visibleArticles, __ATOMIC_ACQUIRE);
+        rv->numTokens = __atomic_load_n(&idx->visibleTokens, __ATOMIC_ACQUIRE);
+        if (publishing % 2 == 0 &&
+            __atomic_load_n(&idx->publishing, __ATOMIC_ACQUIRE) == publishing)
+            return;
+    }
+}
+
+static void EndRead(index_t *idx, readview *rv) {
+    EpochExit(&idx->reclaim, rv->ticket);
 }
 
+/* The postings of the lowercased word that rv can see, as a view in *out,
+   or false if no article has the word */
+static bool ViewPostings(index_t *idx, const readview *rv, const char *lowercasedWord,
+                         postinglist *out) {
+    WordEntry *we = FindWordEntry(idx, lowercasedWord);
+    if (we == NULL) return false;
+    PostingListView(&we->postings, rv->numArticles, out);
+    return true;
+}
+
+/* Fills in rk for a query, first recomputing the BM25 length norms unless
+   the latest ones were computed for just what the query sees.  Queries
+   that find them stale compute their own and publish them for later ones */
+static void PrepareRanking(index_t *idx, const readview *rv, ranking *rk) {
+    int numArticles = rv->numArticles;
+    rk->mode = idx->rankingMode;
+    rk->numArticles = numArticles;
+    rk->lengthNorms = NULL;
+    rk->minLengthNorm = 0;
+    if (rk->mode != kRankByBM25) return;
+
+    lengthnorms *ln = __atomic_load_n(&idx->lengthNorms, __ATOMIC_ACQUIRE);
+    if (ln == NULL || ln->numArticles != numArticles || ln->numTokens != rv->numTokens) {
+        ln = malloc(sizeof(lengthnorms) + (numArticles + 1) * sizeof(float));
+        assert(ln != NULL);
+        ln->numArticles = numArticles;
+        ln->numTokens = rv->numTokens;
+        double avgLength = (numArticles > 0) ? (double)rv->numTokens / numArticles : 0;
+        float min = RankingLengthNorm(0, avgLength);
+        for (int i = 0; i < numArticles; i++) {
+            const Article *art = (const Article *)StableVectorNth(&idx->articles, i);
+            ln->norms[i] = RankingLengthNorm(art->numTokens, avgLength);
+            if (i == 0 || ln->norms[i] < min) min = ln->norms[i];
+        }
+        ln->min = min;
+        EpochRetire(&idx->reclaim, __atomic_exchange_n(&idx->lengthNorms, ln, __ATOMIC_ACQ_REL));
+    }
+    rk->lengthNorms = ln->norms;
+    rk->minLengthNorm = ln->min;
+}
 
 int IndexQueryTopN(index_t *idx, const char *word, int topN, vector *outResults) {
     /* Caller expects outResults to be initialized (rss-news-search always
@@ -362,58 +741,375 @@ int IndexQueryTopN(index_t *idx, const char *word, int topN, vector *outResults)
     }
 
     /* lowercased copy of query word */
-    char *lower = StrDupLower(word);
+    char scratch[kScratchSize];
+    char *lower = LowerInto(scratch, word);
     if (!lower) {
         /* allocation failed: leave outResults empty for caller to dispose */
         return 0;
     }
 
-    /* lookup WordEntry in wordMap (we use a temporary WordEntry for lookup) */
-    WordEntry temp;
-    temp.word = lower;
-    WordEntry *tempPtr = &temp;
-    void *found = HashSetLookup(&idx->wordMap, &tempPtr);
-    if (found == NULL) {
-        free(lower);
+    /* lookup the postings through the term dictionary */
+    readview rv;
+    BeginRead(idx, &rv);
+    postinglist postings;
+    bool found = ViewPostings(idx, &rv, lower, &postings);
+    ReleaseLower(scratch, lower); /* no longer needed */
+    if (!found) {
+        EndRead(idx, &rv);
         /* no such word: outResults stays empty */
         return 0;
     }
 
-    WordEntry *we = *(WordEntry **)found; /* HashSet stores WordEntry* elements */
+    /* decode the postings on the fly, keeping only the best topN in a
+       bounded heap, then hand those over best first.  Once the heap is
+       full, a block whose largest count can't score enough to beat the
+       worst result kept is skipped without being decoded: later articles
+       lose ties, so matching the threshold isn't enough */
+    int total = PostingListLength(&postings);
+    topn best;
+    TopNNew(&best, (topN < total) ? topN : (total > 0 ? total : 1));
+
+    ranking rk;
+    PrepareRanking(idx, &rv, &rk);
+    double weight = RankingWeight(&rk, total);
+
+    postingreader reader;
+    Posting pst;
+    PostingReaderNew(&reader, &postings);
+    int blockMax;
+    double threshold = 0;
+    while ((blockMax = PostingReaderBlockMax(&reader)) > 0) {
+        if (RankingBound(&rk, weight, blockMax) <= threshold) {
+            PostingReaderSkipBlock(&reader);
+            continue;
+        }
+        int blockLast = PostingReaderBlockLast(&reader);
+        while (PostingReaderNext(&reader, &pst)) {
+            double score = RankingScore(&rk, weight, pst.count, pst.article_id);
+            if (score > threshold || threshold == 0) {
+                result_t r;
+                r.article_id = pst.article_id;
+                r.count = pst.count;
+                r.score = score;
+                TopNOffer(&best, &r);
+                threshold = TopNThreshold(&best);
+            }
+            if (pst.article_id == blockLast) break;
+        }
+    }
+    EndRead(idx, &rv);
+
+    TopNDrain(&best, outResults);
+    TopNDispose(&best);
+    return VectorLength(outResults);
+}
+
 
-    /* build a temporary vector of result_t from the postings */
-    vector tempVec;
-    VectorNew(&tempVec, sizeof(result_t), NULL,
-              (VectorLength(&we->postings) > 0) ? VectorLength(&we->postings) : 4);
+int IndexQuery(index_t *idx, const char *text, int topN, vector *outResults,
+               const char **error) {
+    if (outResults == NULL) return 0;
+    VectorNew(outResults, sizeof(result_t), NULL, 0);
+    if (idx == NULL || text == NULL || topN <= 0) return 0;
 
-    for (int i = 0; i < VectorLength(&we->postings); i++) {
-        Posting *pst = (Posting *)VectorNth(&we->postings, i);
-        result_t r;
-        r.article_id = pst->article_id;
-        r.count = pst->count;
-        VectorAppend(&tempVec, &r);
+    query q;
+    const char *problem = QueryParse(&q, text);
+    if (problem != NULL) {
+        if (error != NULL) *error = problem;
+        return -1;
     }
 
-    free(lower); /* no longer needed */
+    /* terms come back lowercased; stop words drop out of the query, and
+       words no article contains have no postings */
+    readview rv;
+    BeginRead(idx, &rv);
+    postinglist views[kMaxQueryTerms];
+    const postinglist *lists[kMaxQueryTerms];
+    for (int i = 0; i < q.numTerms; i++) {
+        const char *term = q.terms[i];
+        lists[i] = NULL;
+        if (HashSetLookup(&idx->stopWords, &term) != NULL) {
+            QueryIgnoreTerm(&q, i);
+            continue;
+        }
+        if (ViewPostings(idx, &rv, term, &views[i])) lists[i] = &views[i];
+    }
+
+    ranking rk;
+    PrepareRanking(idx, &rv, &rk);
+    topn best;
+    TopNNew(&best, topN);
+    QueryRun(&q, lists, &rk, &best);
+    EndRead(idx, &rv);
+    TopNDrain(&best, outResults);
+    TopNDispose(&best);
+    QueryDispose(&q);
+    return VectorLength(outResults);
+}
 
-    if (VectorLength(&tempVec) == 0) {
-        VectorDispose(&tempVec);
-        return 0; /* outResults remains empty */
+/* ----------------------- Snapshots ------------------------------------- */
+
+/* A snapshot is a header followed by five sections, each starting at a
+   multiple of 8 bytes so that it can be used in place once mapped:
+
+       strings     every article's url, title and server, '\0'-terminated
+       articles    an articleimage per article, in article_id order
+       terms       each shard's term dictionary (see TermDictSave), then a
+                   table of their sizes
+       postings    every term's postings and skip table (PostingListSave)
+       entries     a postingimage per term, shard by shard, in term id order
+
+   Integers are in the byte order of the machine that wrote the file, and
+   a file written by any other kind of machine is refused. */
+
+static const char kSnapshotMagic[8] = "RSSINDEX";
+static const uint32_t kSnapshotVersion = 2;
+static const uint32_t kByteOrderMark = 0x01020304;
+
+typedef struct {
+    uint64_t offset;
+    uint64_t size;
+} snapshotsection;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint64_t fileSize;
+    int64_t totalTokens;
+    int32_t numArticles;
+    int32_t numTerms;           /* over all shards */
+    int32_t numShards;
+    int32_t unused;
+    snapshotsection strings, articles, terms, postings, entries;
+} snapshotheader;
+
+typedef struct {
+    uint32_t url;           /* offsets into the strings section */
+    uint32_t title;
+    uint32_t server;
+    int32_t numTokens;
+} articleimage;
+
+static bool WritePadding(FILE *out, uint64_t *offset) {
+    static const char kZeroes[8];
+    size_t padding = (8 - *offset % 8) % 8;
+    *offset += padding;
+    return fwrite(kZeroes, 1, padding, out) == padding;
+}
+
+/* Appends s and its '\0' to the strings section, recording where it went */
+static bool WriteString(FILE *out, const char *s, uint64_t *length, uint32_t *at) {
+    size_t n = strlen(s) + 1;
+    if (*length + n > UINT32_MAX) return false;
+    *at = (uint32_t)*length;
+    *length += n;
+    return fwrite(s, 1, n, out) == n;
+}
+
+static bool WriteSnapshot(index_t *idx, FILE *out) {
+    int numArticles = idx->articles.length;
+    int numTerms = 0;
+    for (int s = 0; s < kNumShards; s++) numTerms += TermDictSize(&idx->shards[s].terms);
+    snapshotheader header;
+    memset(&header, 0, sizeof(header));
+    if (fwrite(&header, sizeof(header), 1, out) != 1) return false;
+    uint64_t offset = sizeof(header);
+
+    articleimage *articles = malloc((numArticles + 1) * sizeof(articleimage));
+    postingimage *entries = malloc((numTerms + 1) * sizeof(postingimage));
+    assert(articles != NULL && entries != NULL);
+    bool ok = true;
+
+    uint64_t length = 0;
+    for (int i = 0; ok && i < numArticles; i++) {
+        const Article *art = (const Article *)StableVectorNth(&idx->articles, i);
+        ok = WriteString(out, art->url, &length, &articles[i].url) &&
+             WriteString(out, art->title, &length, &articles[i].title) &&
+             WriteString(out, art->server, &length, &articles[i].server);
+        articles[i].numTokens = art->numTokens;
     }
+    header.strings.offset = offset;
+    header.strings.size = length;
+    offset += length;
+    ok = ok && WritePadding(out, &offset);
+
+    header.articles.offset = offset;
+    header.articles.size = numArticles * sizeof(articleimage);
+    offset += header.articles.size;
+    ok = ok && fwrite(articles, sizeof(articleimage), numArticles, out) == (size_t)numArticles;
+
+    header.terms.offset = offset;
+    uint64_t termsSizes[kNumShards];
+    for (int s = 0; ok && s < kNumShards; s++) {
+        termsSizes[s] = TermDictSave(&idx->shards[s].terms, out);
+        header.terms.size += termsSizes[s];
+        ok = termsSizes[s] > 0;
+    }
+    header.terms.size += sizeof(termsSizes);
+    offset += header.terms.size;
+    ok = ok && fwrite(termsSizes, sizeof(termsSizes), 1, out) == 1;
+
+    header.postings.offset = offset;
+    for (int s = 0, e = 0; ok && s < kNumShards; s++) {
+        const stablevector *shardEntries = &idx->shards[s].entries;
+        for (int i = 0; ok && i < shardEntries->length; i++, e++) {
+            const WordEntry *we = (const WordEntry *)StableVectorNth(shardEntries, i);
+            ok = PostingListSave(&we->postings, out, &header.postings.size, &entries[e]);
+        }
+    }
+    offset += header.postings.size;
+
+    header.entries.offset = offset;
+    header.entries.size = numTerms * sizeof(postingimage);
+    offset += header.entries.size;
+    ok = ok && fwrite(entries, sizeof(postingimage), numTerms, out) == (size_t)numTerms;
+
+    free(articles);
+    free(entries);
+    if (!ok) return false;
+
+    memcpy(header.magic, kSnapshotMagic, sizeof(header.magic));
+    header.version = kSnapshotVersion;
+    header.byteOrder = kByteOrderMark;
+    header.fileSize = offset;
+    header.totalTokens = idx->totalTokens;
+    header.numArticles = numArticles;
+    header.numTerms = numTerms;
+    header.numShards = kNumShards;
+    return fseek(out, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, out) == 1;
+}
 
-    /* sort the contiguous array inside tempVec (vector stores contiguous elems) */
-    qsort(tempVec.elems, VectorLength(&tempVec), sizeof(result_t), result_t_compare);
+bool IndexSave(index_t *idx, const char *path) {
+    if (idx == NULL || path == NULL) return false;
+
+    /* written beside path and renamed over it, so a crash mid-save never
+       leaves a truncated snapshot behind */
+    size_t n = strlen(path);
+    char *temporary = malloc(n + sizeof(".tmp"));
+    if (temporary == NULL) return false;
+    memcpy(temporary, path, n);
+    memcpy(temporary + n, ".tmp", sizeof(".tmp"));
+
+    FILE *out = fopen(temporary, "wb");
+    bool ok = out != NULL && WriteSnapshot(idx, out);
+    if (out != NULL && fclose(out) != 0) ok = false;
+    if (ok) ok = rename(temporary, path) == 0;
+    if (!ok) remove(temporary);
+    free(temporary);
+    return ok;
+}
 
-    /* copy topN results into outResults (outResults already init'd) */
-    int total = VectorLength(&tempVec);
-    int take = (topN < total) ? topN : total;
+static bool SectionFits(const snapshotsection *section, uint64_t fileSize) {
+    return section->offset % 8 == 0 && section->offset <= fileSize &&
+           section->size <= fileSize - section->offset;
+}
 
-    for (int i = 0; i < take; ++i) {
-        result_t *src = (result_t *)VectorNth(&tempVec, i);
-        VectorAppend(outResults, src);
+/* Builds an index around the snapshot at base, or returns NULL if it isn't
+   one.  Only the article table and the per-term list headers are touched;
+   the dictionary and the postings are used where they lie */
+static index_t *MapSnapshot(const uint8_t *base, size_t size) {
+    const snapshotheader *header = (const snapshotheader *)base;
+    if (size < sizeof(*header) ||
+        memcmp(header->magic, kSnapshotMagic, sizeof(header->magic)) != 0 ||
+        header->version != kSnapshotVersion || header->byteOrder != kByteOrderMark ||
+        header->fileSize != size || header->numArticles < 0 || header->numTerms < 0 ||
+        header->numShards != kNumShards ||
+        !SectionFits(&header->strings, size) || !SectionFits(&header->articles, size) ||
+        !SectionFits(&header->terms, size) || !SectionFits(&header->postings, size) ||
+        !SectionFits(&header->entries, size) ||
+        header->articles.size != header->numArticles * (uint64_t)sizeof(articleimage) ||
+        header->entries.size != header->numTerms * (uint64_t)sizeof(postingimage))
+        return NULL;
+
+    const char *strings = (const char *)base + header->strings.offset;
+    const articleimage *articles = (const articleimage *)(base + header->articles.offset);
+    uint64_t stringsSize = header->strings.size;
+    if (stringsSize > 0 && strings[stringsSize - 1] != '\0') return NULL;
+    for (int i = 0; i < header->numArticles; i++) {
+        if (articles[i].url >= stringsSize || articles[i].title >= stringsSize ||
+            articles[i].server >= stringsSize || articles[i].numTokens < 0)
+            return NULL;
     }
 
-    VectorDispose(&tempVec);
-    return VectorLength(outResults);
+    /* the table of dictionary sizes is at the end of the terms section */
+    uint64_t termsSizes[kNumShards];
+    if (header->terms.size < sizeof(termsSizes)) return NULL;
+    uint64_t termsOffset = header->terms.offset;
+    uint64_t termsLeft = header->terms.size - sizeof(termsSizes);
+    memcpy(termsSizes, base + termsOffset + termsLeft, sizeof(termsSizes));
+    termdict terms[kNumShards];
+    int numTerms = 0, numMapped = 0;
+    for (int s = 0; s < kNumShards; s++, numMapped++) {
+        if (termsSizes[s] > termsLeft ||
+            !TermDictMap(&terms[s], base + termsOffset, termsSizes[s]))
+            break;
+        termsOffset += termsSizes[s];
+        termsLeft -= termsSizes[s];
+        numTerms += TermDictSize(&terms[s]);
+    }
+    index_t *idx = NULL;
+    if (numMapped == kNumShards && termsLeft == 0 && numTerms == header->numTerms)
+        idx = IndexCreate(1);
+    if (idx == NULL) {
+        for (int s = 0; s < numMapped; s++) TermDictDispose(&terms[s]);
+        return NULL;
+    }
+    for (int s = 0; s < kNumShards; s++) {
+        shard *sh = &idx->shards[s];
+        TermDictDispose(&sh->terms);
+        sh->terms = terms[s];
+        sh->nextArticle = header->numArticles;
+    }
+
+    for (int i = 0; i < header->numArticles; i++) {
+        Article art;
+        art.url = (char *)strings + articles[i].url;
+        art.title = (char *)strings + articles[i].title;
+        art.server = (char *)strings + articles[i].server;
+        art.numTokens = articles[i].numTokens;
+        art.complete = true;
+        StableVectorAppend(&idx->articles, &art, NULL);
+    }
+    idx->numMappedArticles = header->numArticles;
+    idx->mappedArticlesUnseen = header->numArticles > 0;
+    idx->totalTokens = header->totalTokens;
+    Publish(idx, header->numArticles, header->totalTokens);
+
+    const postingimage *entries = (const postingimage *)(base + header->entries.offset);
+    for (int s = 0, e = 0; s < kNumShards; s++) {
+        shard *sh = &idx->shards[s];
+        for (int i = 0; i < TermDictSize(&sh->terms); i++, e++) {
+            WordEntry we;
+            if (!PostingListMap(&we.postings, &entries[e], base + header->postings.offset,
+                                header->postings.size)) {
+                IndexDestroy(idx);
+                return NULL;
+            }
+            StableVectorAppend(&sh->entries, &we, NULL);
+        }
+    }
+
+    idx->snapshot = base;
+    idx->snapshotSize = size;
+    return idx;
 }
 
+index_t *IndexLoad(const char *path) {
+    if (path == NULL) return NULL;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || sb.st_size < (off_t)sizeof(snapshotheader) ||
+        (uint64_t)sb.st_size > SIZE_MAX) {
+        close(fd);
+        return NULL;
+    }
+    size_t size = (size_t)sb.st_size;
+    void *base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return NULL;
+
+    index_t *idx = MapSnapshot(base, size);
+    if (idx == NULL) munmap(base, size);
+    return idx;
+}
@@ -3,52 +3,116 @@
 
 #include "vector.h"
 #include "hashset.h"
+#include "postings.h"
+#include "ranking.h"
+#include "termcounts.h"
 #include <stdbool.h>
 
-/* Represents an article */
+/* Represents an article; its strings belong to the index, which allocates
+ * them all from one arena and frees them together */
 typedef struct {
     char *url;
     char *title;
     char *server;
+    int numTokens;      /* indexed words, duplicates included */
+    bool complete;      /* every posting is in */
 } Article;
 
-/* Posting of a word in an article */
+/* WordEntry: postings of one word.  Entries are addressed by the word's
+ * term id; the lowercase word itself is interned in the index's termdict */
 typedef struct {
-    int article_id;
-    int count;
-} Posting;
-
-/* WordEntry: word string + postings vector */
-typedef struct {
-    char *word;          /* lowercase */
-    vector postings;     /* vector of Posting */
+    postinglist postings;   /* compressed, sorted by article_id */
 } WordEntry;
 
 /* Opaque Index structure */
 typedef struct index index_t;
 
+/* Concurrency: queries (IndexQueryTopN, IndexQuery and the article
+ * lookups) take no locks, and any number of them can run at once, on any
+ * threads, while IndexAddArticle goes on adding articles.  Each query sees
+ * the index as of when it began: every article registered before the
+ * first one still being merged, all of its postings, and none of any
+ * article after.  Whatever memory growth replaces is freed only once no
+ * query can still be using it.  Everything else (loading, stop words,
+ * the ranking mode and the one-token-at-a-time calls) is for an index that
+ * isn't being queried at the same time, and IndexSave, which only reads,
+ * mustn't overlap insertions */
+
 /* Lifecycle */
 index_t *IndexCreate(int numBuckets);
 void IndexDestroy(index_t *idx);
 
+/* Snapshots: IndexSave writes the articles, term dictionary and postings to
+ * a single versioned file (replacing it only once it's complete), and
+ * IndexLoad maps such a file and returns an index that answers queries
+ * straight out of the mapped pages, decoding nothing up front.  A loaded
+ * index can go on growing, and new articles are checked for duplicates
+ * among the loaded ones as usual.  Stop words and the ranking mode aren't
+ * saved.  IndexSave returns false and IndexLoad NULL if the file can't be
+ * written or isn't a snapshot this build can read */
+bool IndexSave(index_t *idx, const char *path);
+index_t *IndexLoad(const char *path);
+
 /* Stop words */
 bool IndexLoadStopWords(index_t *idx, const char *stopWordsFile);
 bool IndexIsStopWord(index_t *idx, const char *word);
 
-/* Articles */
+/* Articles.  Registration and the duplicate checks are thread-safe */
 int IndexRegisterArticle(index_t *idx, const char *url, const char *title);
+
+/* True if IndexRegisterArticle would turn the article down as a duplicate:
+ * its url, or its server and title, belong to an article already indexed.
+ * Lets a crawler skip downloading articles it has seen on an earlier poll */
+bool IndexContainsArticle(index_t *idx, const char *url, const char *title);
+/* A loaded index refills its duplicate-detection sets from every loaded
+ * article the first time they're needed, which takes a while for a big
+ * index.  IndexPrepareDuplicateChecks does it right away, so a crawler can
+ * get it out of the way before it starts checking items on a thread that
+ * mustn't stall.  Does nothing if there's nothing to refill */
+void IndexPrepareDuplicateChecks(index_t *idx);
 const char *IndexGetArticleTitle(index_t *idx, int article_id);
 const char *IndexGetArticleURL(index_t *idx, int article_id);
 
-/* Token insertion */
+/* Token insertion: all of an article's tokens must be added before any token
+ * of a later-registered article, which keeps every postings vector sorted by
+ * article_id and lets each insertion touch only its tail */
 void IndexAddToken(index_t *idx, int article_id, const char *token);
 
+/* Same as count calls to IndexAddToken, but with a single lookup: the way to
+ * merge an article's pre-counted terms.  Every token that isn't a stop word
+ * also counts toward the article's length, for BM25 */
+void IndexAddTokenCount(index_t *idx, int article_id, const char *token, int count);
+
+/* Concurrent insertion: registers an article as IndexRegisterArticle does
+ * and, unless it's a duplicate, merges all of its terms (as counted while
+ * scanning it) as IndexAddTokenCount would, returning its id or -1.  Any
+ * number of threads may call this at once: the words are split into shards
+ * by hash, each with its own lock, and each shard takes articles in id
+ * order, so a thread only ever waits for articles registered before its
+ * own.  Not to be overlapped with the one-token-at-a-time calls above */
+int IndexAddArticle(index_t *idx, const char *url, const char *title,
+                    const termcounts *terms);
+
 /* Query */
 typedef struct {
     int article_id;
-    int count;
+    int count;          /* occurrences of the word(s) matched */
+    double score;       /* what results are ranked by: count, unless BM25 */
 } result_t;
 
+/* Ranking used by both query functions; kRankByCount (the default) or
+ * kRankByBM25.  BM25 length norms are recomputed by the first query that
+ * sees more articles or tokens than they were computed for */
+void IndexSetRanking(index_t *idx, rankingmode mode);
+
 int IndexQueryTopN(index_t *idx, const char *word, int topN, vector *outResults);
 
+/* Multi-word query with AND, OR and NOT (syntax and scoring in query.h): the
+ * topN best articles, ranked as by IndexQueryTopN with count and score
+ * holding the sums over the matched words.  Stop words are ignored.  outResults
+ * is always initialized; returns the number of results, or -1 with *error
+ * set if the query doesn't parse */
+int IndexQuery(index_t *idx, const char *text, int topN, vector *outResults,
+               const char **error);
+
 #endif // INDEX_H
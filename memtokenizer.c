@@ -0,0 +1,322 @@
+/* memtokenizer.c
+ *
+ * Every scan is a tight loop over the delimiter set's lookup table, so
+ * classifying a character costs one load no matter how many delimiters
+ * there are.  Multi-character tokens (by far the most bytes of any article)
+ * are measured by a vector scanner where the CPU has one: it tests 16 or 32
+ * bytes at once for "letter, digit or non-ASCII", which are token characters
+ * in any vectorizable set, and only looks up the bytes that fail that test.
+ * Inside a CDATA section, end is pulled in to the section's "]]>", so none
+ * of the scanners can run past it, and whatever reaches that end steps over
+ * the marker and restores the real one.
+ */
+
+#include "memtokenizer.h"
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <assert.h>
+#include <pthread.h>
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <immintrin.h>
+#define HAVE_X86_SCANNERS 1
+#endif
+
+enum { kTokenChar = 0, kSkippedDelimiter = 1, kKeptDelimiter = 2 };
+
+/* Returns the first byte in [p, end) that isn't a token character, or end */
+typedef const char *(*ScanFunction)(const unsigned char *kind, const char *p,
+                                    const char *end);
+
+static const char *ScanTokenScalar(const unsigned char *kind, const char *p,
+                                   const char *end) {
+    while (p < end && kind[(unsigned char)*p] == kTokenChar) p++;
+    return p;
+}
+
+#ifdef HAVE_X86_SCANNERS
+
+/* The set bits of candidates are the bytes of the block at p that might be
+ * delimiters; returns the first that really is, or NULL */
+static inline const char *FirstDelimiter(const unsigned char *kind, const char *p,
+                                         unsigned int candidates) {
+    while (candidates != 0) {
+        int i = __builtin_ctz(candidates);
+        if (kind[(unsigned char)p[i]] != kTokenChar) return p + i;
+        candidates &= candidates - 1;
+    }
+    return NULL;
+}
+
+/* Bit i is set if byte i of the 16 at p is a letter, digit or non-ASCII */
+__attribute__((target("sse2")))
+static inline unsigned int TokenChars16(const char *p) {
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    __m128i letter = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                                   _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+    __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+                                  _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+    __m128i nonASCII = _mm_cmplt_epi8(v, _mm_setzero_si128());
+    return _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(letter, digit), nonASCII));
+}
+
+__attribute__((target("sse2")))
+static const char *ScanTokenSSE2(const unsigned char *kind, const char *p,
+                                 const char *end) {
+    while (end - p >= 16) {
+        const char *hit = FirstDelimiter(kind, p, ~TokenChars16(p) & 0xFFFFu);
+        if (hit != NULL) return hit;
+        p += 16;
+    }
+    return ScanTokenScalar(kind, p, end);
+}
+
+/* Most words end within 16 bytes, so the first block is checked with the
+ * narrower SSE2 test and only longer runs switch to 32-byte blocks */
+__attribute__((target("avx2")))
+static const char *ScanTokenAVX2(const unsigned char *kind, const char *p,
+                                 const char *end) {
+    if (end - p >= 16) {
+        const char *hit = FirstDelimiter(kind, p, ~TokenChars16(p) & 0xFFFFu);
+        if (hit != NULL) return hit;
+        p += 16;
+    }
+    const __m256i caseBit = _mm256_set1_epi8(0x20);
+    const __m256i beforeA = _mm256_set1_epi8('a' - 1), afterZ = _mm256_set1_epi8('z' + 1);
+    const __m256i before0 = _mm256_set1_epi8('0' - 1), after9 = _mm256_set1_epi8('9' + 1);
+    const __m256i zero = _mm256_setzero_si256();
+    while (end - p >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        __m256i lower = _mm256_or_si256(v, caseBit);
+        __m256i letter = _mm256_and_si256(_mm256_cmpgt_epi8(lower, beforeA),
+                                          _mm256_cmpgt_epi8(afterZ, lower));
+        __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(v, before0),
+                                         _mm256_cmpgt_epi8(after9, v));
+        __m256i nonASCII = _mm256_cmpgt_epi8(zero, v);
+        unsigned int tokenChars = (unsigned int)_mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_or_si256(letter, digit), nonASCII));
+        const char *hit = FirstDelimiter(kind, p, ~tokenChars);
+        if (hit != NULL) return hit;
+        p += 32;
+    }
+    return ScanTokenSSE2(kind, p, end);
+}
+
+#endif // HAVE_X86_SCANNERS
+
+typedef struct {
+    const char *name;
+    ScanFunction scan;
+} scanner;
+
+static const scanner kScanners[] = {   /* fastest first */
+#ifdef HAVE_X86_SCANNERS
+    { "avx2", ScanTokenAVX2 },
+    { "sse2", ScanTokenSSE2 },
+#endif
+    { "scalar", ScanTokenScalar },
+};
+static const int kNumScanners = sizeof(kScanners) / sizeof(kScanners[0]);
+
+static const scanner *gScanner = NULL;
+static pthread_once_t gScannerOnce = PTHREAD_ONCE_INIT;
+
+static bool ScannerSupported(const scanner *sc) {
+#ifdef HAVE_X86_SCANNERS
+    __builtin_cpu_init();
+    if (sc->scan == ScanTokenAVX2) return __builtin_cpu_supports("avx2");
+    if (sc->scan == ScanTokenSSE2) return __builtin_cpu_supports("sse2");
+#endif
+    return true;
+}
+
+static void SelectBestScanner(void) {
+    for (int i = 0; i < kNumScanners; i++) {
+        if (ScannerSupported(&kScanners[i])) {
+            gScanner = &kScanners[i];
+            return;
+        }
+    }
+}
+
+const char *MTSelectScanner(const char *name) {
+    pthread_once(&gScannerOnce, SelectBestScanner);
+    if (name == NULL) {
+        SelectBestScanner();
+        return gScanner->name;
+    }
+    for (int i = 0; i < kNumScanners; i++) {
+        if (strcmp(kScanners[i].name, name) == 0 && ScannerSupported(&kScanners[i])) {
+            gScanner = &kScanners[i];
+            return gScanner->name;
+        }
+    }
+    return NULL;
+}
+
+static inline const char *ScanTokenRun(const delimiterset *ds, const char *p,
+                                       const char *end) {
+    if (!ds->vectorizable) return ScanTokenScalar(ds->kind, p, end);
+    return gScanner->scan(ds->kind, p, end);   /* chosen by DSNew */
+}
+
+void DSNew(delimiterset *ds, const char *delimiters, const char *keptDelimiters) {
+    assert(ds != NULL && delimiters != NULL && keptDelimiters != NULL);
+    memset(ds->kind, kTokenChar, sizeof(ds->kind));
+    for (const char *p = delimiters; *p != '\0'; p++)
+        ds->kind[(unsigned char)*p] = kSkippedDelimiter;
+    for (const char *p = keptDelimiters; *p != '\0'; p++) {
+        assert(ds->kind[(unsigned char)*p] != kTokenChar);
+        ds->kind[(unsigned char)*p] = kKeptDelimiter;
+    }
+
+    ds->vectorizable = true;
+    for (int ch = 0; ch < 256; ch++) {
+        bool alnum = (ch >= '0' && ch <= '9') || (ch >= 'a' && ch <= 'z') ||
+                     (ch >= 'A' && ch <= 'Z');
+        if (ds->kind[ch] != kTokenChar && (ch >= 0x80 || alnum))
+            ds->vectorizable = false;
+    }
+    pthread_once(&gScannerOnce, SelectBestScanner);
+}
+
+void MTNew(memtokenizer *mt, const char *text, size_t length,
+           const delimiterset *delimiters) {
+    assert(mt != NULL && delimiters != NULL);
+    assert(text != NULL || length == 0);
+    mt->cursor = text;
+    mt->end = mt->textEnd = text + length;
+    mt->delimiters = delimiters;
+}
+
+static const char *const kCDataOpener = "![CDATA[";   /* after the '<' */
+static const char *const kCDataCloser = "]]>";
+
+/* Returns the first "]]>" in [p, end), or NULL */
+static const char *FindCDataCloser(const char *p, const char *end) {
+    while (end - p >= 3) {
+        const char *hit = memchr(p, ']', end - p - 2);
+        if (hit == NULL) break;
+        if (hit[1] == ']' && hit[2] == '>') return hit;
+        p = hit + 1;
+    }
+    return NULL;
+}
+
+/* If the cursor has reached the end of a CDATA section, steps over its
+ * "]]>" and returns true; otherwise (at the end of the text) returns false */
+static bool LeaveCData(memtokenizer *mt) {
+    if (mt->cursor < mt->end || mt->end == mt->textEnd) return false;
+    mt->cursor = mt->end + strlen(kCDataCloser);
+    mt->end = mt->textEnd;
+    return true;
+}
+
+bool MTNextTokenUsingDifferentDelimiters(memtokenizer *mt, slice *token,
+                                         const delimiterset *delimiters) {
+    const unsigned char *kind = delimiters->kind;
+    const char *p, *end;
+
+    while (true) {
+        p = mt->cursor;
+        end = mt->end;
+        while (p < end && kind[(unsigned char)*p] == kSkippedDelimiter) p++;
+        mt->cursor = p;
+        if (p < end) break;
+        if (!LeaveCData(mt)) return false;
+    }
+
+    token->start = p;
+    if (kind[(unsigned char)*p] == kKeptDelimiter) {
+        p++;
+    } else {
+        p = ScanTokenRun(delimiters, p, end);
+    }
+    token->length = p - token->start;
+    mt->cursor = p;
+    return true;
+}
+
+bool MTNextToken(memtokenizer *mt, slice *token) {
+    return MTNextTokenUsingDifferentDelimiters(mt, token, mt->delimiters);
+}
+
+int MTSkipOver(memtokenizer *mt, const delimiterset *skipSet) {
+    do {
+        const char *p = mt->cursor;
+        while (p < mt->end && DSContains(skipSet, *p)) p++;
+        mt->cursor = p;
+    } while (LeaveCData(mt));
+    return (mt->cursor < mt->end) ? (unsigned char)*mt->cursor : EOF;
+}
+
+int MTSkipUntil(memtokenizer *mt, const delimiterset *skipUntilSet) {
+    do {
+        const char *p = mt->cursor;
+        while (p < mt->end && !DSContains(skipUntilSet, *p)) p++;
+        mt->cursor = p;
+    } while (LeaveCData(mt));
+    return (mt->cursor < mt->end) ? (unsigned char)*mt->cursor : EOF;
+}
+
+/* Returns the first case-insensitive occurrence of needle in [p, end), or end */
+static const char *FindCaseInsensitive(const char *p, const char *end, const char *needle) {
+    size_t n = strlen(needle);
+    while ((size_t)(end - p) >= n) {
+        const char *hit = memchr(p, needle[0], end - p - n + 1);
+        if (hit == NULL) break;
+        if (strncasecmp(hit, needle, n) == 0) return hit;
+        p = hit + 1;
+    }
+    return end;
+}
+
+static const char *SkipPast(const char *p, const char *end, const char *needle) {
+    const char *hit = FindCaseInsensitive(p, end, needle);
+    return (hit == end) ? end : hit + strlen(needle);
+}
+
+static bool StartsTag(const char *p, const char *end, const char *name) {
+    size_t n = strlen(name);
+    return (size_t)(end - p) >= n && strncasecmp(p, name, n) == 0;
+}
+
+/* Same as StartsTag, but name must be the element's whole name, so that
+   "script" doesn't match <scripts> */
+static bool StartsElement(const char *p, const char *end, const char *name) {
+    if (!StartsTag(p, end, name)) return false;
+    p += strlen(name);
+    return p == end || *p == '>' || *p == '/' || isspace((unsigned char)*p);
+}
+
+void MTSkipIrrelevantContent(memtokenizer *mt) {
+    const char *p = mt->cursor, *end = mt->end;
+
+    if (StartsTag(p, end, kCDataOpener)) {
+        p += strlen(kCDataOpener);
+        const char *closer = FindCDataCloser(p, end);
+        mt->cursor = p;
+        if (closer != NULL) mt->end = closer;   /* unterminated: runs to the end */
+        return;
+    }
+    if (StartsTag(p, end, "!--")) {
+        mt->cursor = SkipPast(p + 3, end, "-->");
+        return;
+    }
+
+    const char *tagEnd = memchr(p, '>', end - p);
+    tagEnd = (tagEnd == NULL) ? end : tagEnd + 1;
+    if (StartsElement(p, end, "script")) {
+        p = FindCaseInsensitive(tagEnd, end, "</script");
+    } else if (StartsElement(p, end, "style")) {
+        p = FindCaseInsensitive(tagEnd, end, "</style");
+    } else {
+        mt->cursor = tagEnd;
+        return;
+    }
+    const char *closeEnd = (p == end) ? NULL : memchr(p, '>', end - p);
+    mt->cursor = (closeEnd == NULL) ? end : closeEnd + 1;
+}
@@ -0,0 +1,171 @@
+#ifndef _memtokenizer_
+#define _memtokenizer_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Type: slice
+ * -----------
+ * A token as handed back by the memtokenizer: a pointer into the
+ * tokenized text plus a length.  Slices are not '\0'-terminated, and
+ * they are only valid for as long as the underlying text is.
+ */
+
+typedef struct {
+  const char *start;
+  size_t length;
+} slice;
+
+/**
+ * Type: delimiterset
+ * ------------------
+ * A 256-entry lookup table that classifies every byte value as a
+ * token character, a delimiter to be skipped, or a delimiter to be
+ * returned as a one-character token.  Build one with DSNew, once, and
+ * share it between as many memtokenizers (and threads) as you like;
+ * it's never modified after DSNew returns.
+ */
+
+typedef struct {
+  unsigned char kind[256];
+  bool vectorizable;   /* no letter, digit or non-ASCII byte is a delimiter */
+} delimiterset;
+
+/**
+ * Function: DSNew
+ * ---------------
+ * Initializes ds so that every character of delimiters is a delimiter.
+ * Those that also appear in keptDelimiters are returned as one-character
+ * tokens, and the rest are skipped and never contribute to a token.
+ * Passing "" for keptDelimiters is the equivalent of a streamtokenizer
+ * with discardDelimiters set to true; passing delimiters again is the
+ * equivalent of discardDelimiters set to false.
+ */
+
+void DSNew(delimiterset *ds, const char *delimiters, const char *keptDelimiters);
+
+/**
+ * Function: DSContains
+ * --------------------
+ * Returns true if and only if ch is one of ds's delimiters.
+ */
+
+static inline bool DSContains(const delimiterset *ds, char ch) {
+  return ds->kind[(unsigned char)ch] != 0;
+}
+
+/**
+ * Type: memtokenizer
+ * ------------------
+ * The in-memory counterpart of the streamtokenizer: it walks a
+ * contiguous, already-loaded range of bytes instead of pulling
+ * characters one at a time from a FILE *, and hands back each token as
+ * a slice of that range instead of copying it into a client buffer.
+ *
+ *     static delimiterset kWhiteSpace;   // DSNew(&kWhiteSpace, " \t\n\r", "") once
+ *     void PrintAllWords(const char *text, size_t length)
+ *     {
+ *         memtokenizer mt;
+ *         slice word;
+ *         MTNew(&mt, text, length, &kWhiteSpace);
+ *         while (MTNextToken(&mt, &word)) {
+ *             printf("%.*s\n", (int) word.length, word.start);
+ *         }
+ *     }
+ *
+ * As with the streamtokenizer, pretend the fields are private.  There's
+ * no MTDispose, because a memtokenizer neither allocates nor owns anything.
+ */
+
+typedef struct {
+  const char *cursor;
+  const char *end;        /* of the CDATA section we're in, if any */
+  const char *textEnd;    /* of the whole text */
+  const delimiterset *delimiters;
+} memtokenizer;
+
+/**
+ * Function: MTNew
+ * ---------------
+ * Initializes mt to tokenize the length bytes at text using the
+ * specified delimiter set, which must outlive mt.  The text need
+ * not be '\0'-terminated; an embedded '\0' is just another character.
+ */
+
+void MTNew(memtokenizer *mt, const char *text, size_t length,
+           const delimiterset *delimiters);
+
+/**
+ * Function: MTNextToken
+ * ---------------------
+ * Forms the next token exactly as STNextToken would, skipping delimiters
+ * that aren't kept, returning kept ones as one-character tokens, and
+ * otherwise accumulating characters up to (but not including) the next
+ * delimiter or the end of the text.  Tokens are never truncated, since
+ * there's no client buffer to overflow.  Returns false, leaving token
+ * untouched, once nothing but skipped delimiters remain.
+ */
+
+bool MTNextToken(memtokenizer *mt, slice *token);
+
+/**
+ * Function: MTNextTokenUsingDifferentDelimiters
+ * ---------------------------------------------
+ * Operates exactly the same as MTNextToken, except that the specified
+ * delimiter set is used in place of the one given to MTNew, for this
+ * one call only.
+ */
+
+bool MTNextTokenUsingDifferentDelimiters(memtokenizer *mt, slice *token,
+                                         const delimiterset *delimiters);
+
+/**
+ * Functions: MTSkipOver, MTSkipUntil
+ * ----------------------------------
+ * The equivalents of STSkipOver and STSkipUntil.  MTSkipOver advances past
+ * every character that is a delimiter in skipSet, and MTSkipUntil past
+ * every one that isn't.  Both leave the stopping character in place and
+ * return it (as an unsigned char), or EOF if the end of the text was
+ * reached.
+ */
+
+int MTSkipOver(memtokenizer *mt, const delimiterset *skipSet);
+int MTSkipUntil(memtokenizer *mt, const delimiterset *skipUntilSet);
+
+/**
+ * Function: MTSkipIrrelevantContent
+ * ---------------------------------
+ * The memtokenizer version of SkipIrrelevantContent from html-utils.h.  It
+ * assumes that "<" has just been pulled, and skips everything through the
+ * balancing ">".  HTML comments are skipped through their closing "-->",
+ * and <script> and <style> elements are skipped through their matching
+ * </script> or </style> tag, since neither holds any indexable text.
+ *
+ * A <![CDATA[ section is different: only the opening marker is skipped, and
+ * the tokenizer then goes on to hand back the section's contents like any
+ * other text, treating the closing ]]> as the end of a token and stepping
+ * over it.  (Any markup inside the section is still markup, as far as the
+ * caller is concerned; feeds and pages use CDATA to wrap HTML.)
+ */
+
+void MTSkipIrrelevantContent(memtokenizer *mt);
+
+/**
+ * Function: MTSelectScanner
+ * -------------------------
+ * Every memtokenizer finds the end of a multi-character token with the
+ * fastest scanner the CPU supports, chosen at runtime: "avx2" (32 bytes at a
+ * time), "sse2" (16 bytes at a time) or the portable "scalar" loop.  The
+ * vector scanners rule out letters, digits and non-ASCII bytes in bulk and
+ * consult the lookup table only for the rest, so they're used only with
+ * delimiter sets that don't contain any of those.  MTSelectScanner forces a
+ * particular scanner (NULL restores the automatic choice) and returns the
+ * name of the one now in effect, or NULL if the CPU can't run the one
+ * requested.  It's meant for benchmarks, and mustn't be called while other
+ * threads are tokenizing.
+ */
+
+const char *MTSelectScanner(const char *name);
+
+#endif
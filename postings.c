@@ -0,0 +1,297 @@
+/* postings.c
+ *
+ * Variable-byte coding, little end first.  Gaps are always at least 1
+ * because article_ids strictly increase, and the first gap of every block
+ * is measured from the last article_id of the block before (-1 for the
+ * first block), which is exactly what a straight decode would have had, so
+ * the skip table costs no extra bytes in the postings themselves.
+ *
+ * A view is taken while the list may be growing, so the fields it starts
+ * from are only stored atomically, in an order that keeps them consistent
+ * for a reader that loads them in the opposite order: bytes before length,
+ * a block's entry and the blocks array before numBlocks, and all of those
+ * before the tail.  A view that sees a tail has all that came before it; one
+ * that sees more bytes than its tail implies just finds the tail already
+ * encoded.  Nothing else a view looks at is trusted: it decodes the open
+ * block itself.
+ */
+
+#include "postings.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+static const uint32_t kInitialBytes = 8;
+
+void PostingListNew(postinglist *pl) {
+    pl->bytes = NULL;
+    pl->length = pl->allocated = 0;
+    pl->encodedArticleId = -1;
+    pl->tail.article_id = -1;
+    pl->tail.count = 0;
+    pl->numPostings = 0;
+    pl->maxCount = pl->openMaxCount = 0;
+    pl->blocks = NULL;
+    pl->numBlocks = pl->blocksAllocated = 0;
+}
+
+void PostingListDispose(postinglist *pl) {
+    if (pl->allocated > 0) free(pl->bytes);
+    if (pl->blocksAllocated > 0) free(pl->blocks);
+    pl->bytes = NULL;
+    pl->blocks = NULL;
+}
+
+int PostingListLength(const postinglist *pl) {
+    return pl->numPostings;
+}
+
+int PostingListMaxCount(const postinglist *pl) {
+    return pl->maxCount;
+}
+
+/* realloc, except that memory the list doesn't own (it's mapped from a
+   snapshot) is copied rather than resized, and so is memory views may be
+   reading, whose old copy is retired instead of freed */
+static void *Regrow(void *old, bool owned, size_t used, size_t size, epoch *reclaim) {
+    if (owned && reclaim == NULL) return realloc(old, size);
+    void *fresh = malloc(size);
+    if (fresh != NULL && used > 0) memcpy(fresh, old, used);
+    if (owned) EpochRetire(reclaim, old);
+    return fresh;
+}
+
+static void Reserve(postinglist *pl, uint32_t extra, epoch *reclaim) {
+    if (pl->length + extra <= pl->allocated) return;
+    uint32_t allocated = pl->allocated ? pl->allocated : kInitialBytes;
+    while (pl->length + extra > allocated) allocated *= 2;
+    uint8_t *bytes = Regrow(pl->bytes, pl->allocated > 0, pl->length, allocated, reclaim);
+    assert(bytes != NULL);
+    __atomic_store_n(&pl->bytes, bytes, __ATOMIC_RELEASE);
+    pl->allocated = allocated;
+}
+
+/* Writes value at bytes + at, returning the offset just past it */
+static uint32_t PutVarint(uint8_t *bytes, uint32_t at, uint32_t value) {
+    while (value >= 0x80) {
+        bytes[at++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    bytes[at++] = (uint8_t)value;
+    return at;
+}
+
+static void CloseBlock(postinglist *pl, epoch *reclaim) {
+    if (pl->numBlocks == pl->blocksAllocated || pl->blocksAllocated == 0) {
+        bool owned = pl->blocksAllocated > 0;
+        pl->blocksAllocated = pl->numBlocks ? 2 * pl->numBlocks : 4;
+        postingblock *blocks = Regrow(pl->blocks, owned, pl->numBlocks * sizeof(postingblock),
+                                      pl->blocksAllocated * sizeof(postingblock), reclaim);
+        assert(blocks != NULL);
+        __atomic_store_n(&pl->blocks, blocks, __ATOMIC_RELEASE);
+    }
+    postingblock *b = &pl->blocks[pl->numBlocks];
+    b->lastArticleId = pl->encodedArticleId;
+    b->end = pl->length;
+    b->maxCount = pl->openMaxCount;
+    pl->openMaxCount = 0;
+    __atomic_store_n(&pl->numBlocks, pl->numBlocks + 1, __ATOMIC_RELEASE);
+}
+
+void PostingListAdd(postinglist *pl, int article_id, int count) {
+    PostingListAddShared(pl, article_id, count, NULL);
+}
+
+void PostingListAddShared(postinglist *pl, int article_id, int count,
+                          epoch *reclaim) {
+    assert(count > 0);
+    Posting tail = pl->tail;
+    if (tail.count > 0 && tail.article_id == article_id) {
+        tail.count += count;
+        if (tail.count > pl->maxCount)
+            __atomic_store_n(&pl->maxCount, tail.count, __ATOMIC_RELAXED);
+        __atomic_store(&pl->tail, &tail, __ATOMIC_RELEASE);
+        return;
+    }
+    assert(article_id > tail.article_id);
+    if (tail.count > 0) {
+        Reserve(pl, 10, reclaim); /* two 5-byte varints at most */
+        uint32_t length = PutVarint(pl->bytes, pl->length,
+                                    (uint32_t)(tail.article_id - pl->encodedArticleId));
+        length = PutVarint(pl->bytes, length, (uint32_t)tail.count);
+        __atomic_store_n(&pl->length, length, __ATOMIC_RELEASE);
+        pl->encodedArticleId = tail.article_id;
+        if (tail.count > pl->openMaxCount) pl->openMaxCount = tail.count;
+        if (pl->numPostings % kPostingsPerBlock == 0) CloseBlock(pl, reclaim);
+    }
+    tail.article_id = article_id;
+    tail.count = count;
+    pl->numPostings++;
+    if (count > pl->maxCount) __atomic_store_n(&pl->maxCount, count, __ATOMIC_RELAXED);
+    __atomic_store(&pl->tail, &tail, __ATOMIC_RELEASE);
+}
+
+static const uint8_t kPadding[8];
+
+/* Writes size bytes and then zeroes up to the next multiple of 8 */
+static bool WritePadded(FILE *out, const void *data, size_t size, uint64_t *offset) {
+    size_t padding = (8 - size % 8) % 8;
+    if (size > 0 && fwrite(data, 1, size, out) != size) return false;
+    if (padding > 0 && fwrite(kPadding, 1, padding, out) != padding) return false;
+    *offset += size + padding;
+    return true;
+}
+
+bool PostingListSave(const postinglist *pl, FILE *out, uint64_t *offset,
+                     postingimage *image) {
+    image->bytesOffset = *offset;
+    if (!WritePadded(out, pl->bytes, pl->length, offset)) return false;
+    image->blocksOffset = *offset;
+    if (!WritePadded(out, pl->blocks, pl->numBlocks * sizeof(postingblock), offset))
+        return false;
+    image->length = pl->length;
+    image->numBlocks = pl->numBlocks;
+    image->encodedArticleId = pl->encodedArticleId;
+    image->tailArticleId = pl->tail.article_id;
+    image->tailCount = pl->tail.count;
+    image->numPostings = pl->numPostings;
+    image->maxCount = pl->maxCount;
+    image->openMaxCount = pl->openMaxCount;
+    return true;
+}
+
+bool PostingListMap(postinglist *pl, const postingimage *image,
+                    const uint8_t *data, uint64_t size) {
+    PostingListNew(pl);
+    uint64_t blocksSize = (uint64_t)image->numBlocks * sizeof(postingblock);
+    if (image->numBlocks < 0 || image->numPostings < 0 || image->tailCount < 0 ||
+        image->bytesOffset % 8 != 0 || image->blocksOffset % 8 != 0 ||
+        image->bytesOffset > size || image->length > size - image->bytesOffset ||
+        image->blocksOffset > size || blocksSize > size - image->blocksOffset)
+        return false;
+
+    if (image->length > 0) pl->bytes = (uint8_t *)data + image->bytesOffset;
+    pl->length = image->length;
+    if (image->numBlocks > 0)
+        pl->blocks = (postingblock *)(data + image->blocksOffset);
+    pl->numBlocks = image->numBlocks;
+    pl->encodedArticleId = image->encodedArticleId;
+    pl->tail.article_id = image->tailArticleId;
+    pl->tail.count = image->tailCount;
+    pl->numPostings = image->numPostings;
+    pl->maxCount = image->maxCount;
+    pl->openMaxCount = image->openMaxCount;
+    return true;
+}
+
+void PostingReaderNew(postingreader *r, const postinglist *pl) {
+    r->list = pl;
+    r->cursor = pl->bytes;
+    r->end = (pl->bytes != NULL) ? pl->bytes + pl->length : NULL;
+    r->article_id = -1;
+    r->block = 0;
+    r->tail = pl->tail;
+}
+
+
+/* Returns the first block at or after from whose last article_id is at least
+ * target (numBlocks if none), probing from ever further strides first */
+static int GallopToBlock(const postinglist *pl, int from, int target) {
+    int lo = from, hi = from, step = 1;
+    while (hi < pl->numBlocks && pl->blocks[hi].lastArticleId < target) {
+        lo = hi + 1;
+        hi += step;
+        step *= 2;
+    }
+    if (hi > pl->numBlocks) hi = pl->numBlocks;
+    while (lo < hi) {   /* blocks[lo - 1] is known to end before target */
+        int mid = lo + (hi - lo) / 2;
+        if (pl->blocks[mid].lastArticleId < target) lo = mid + 1; else hi = mid;
+    }
+    return lo;
+}
+
+void PostingListView(const postinglist *pl, int limit, postinglist *view) {
+    Posting tail;
+    __atomic_load(&pl->tail, &tail, __ATOMIC_ACQUIRE);
+    int numBlocks = __atomic_load_n(&pl->numBlocks, __ATOMIC_ACQUIRE);
+    postingblock *blocks = __atomic_load_n(&pl->blocks, __ATOMIC_ACQUIRE);
+    uint32_t length = __atomic_load_n(&pl->length, __ATOMIC_ACQUIRE);
+    uint8_t *bytes = __atomic_load_n(&pl->bytes, __ATOMIC_ACQUIRE);
+
+    PostingListNew(view);   /* owns nothing, like a mapped list */
+    view->bytes = bytes;
+    view->blocks = blocks;
+    view->numBlocks = numBlocks;
+    view->maxCount = __atomic_load_n(&pl->maxCount, __ATOMIC_RELAXED);
+
+    /* whole blocks up to the first that reaches limit, then whatever comes
+       before limit in the postings after them */
+    int kept = GallopToBlock(view, 0, limit);
+    int last = (kept > 0) ? blocks[kept - 1].lastArticleId : -1;
+    uint32_t at = (kept > 0) ? blocks[kept - 1].end : 0;
+    int numOpen = 0, openMax = 0;
+    while (at < length) {
+        const uint8_t *cursor = bytes + at;
+        int article_id = last + (int)PostingGetVarint(&cursor);
+        int count = (int)PostingGetVarint(&cursor);
+        if (article_id >= limit) break;
+        last = article_id;
+        at = cursor - bytes;
+        numOpen++;
+        if (count > openMax) openMax = count;
+    }
+    view->numBlocks = kept;
+    view->length = at;
+    view->encodedArticleId = last;
+    view->openMaxCount = openMax;
+    view->numPostings = kept * kPostingsPerBlock + numOpen;
+    if (tail.count > 0 && tail.article_id > last && tail.article_id < limit) {
+        view->tail = tail;
+        view->numPostings++;
+    }
+}
+
+void PostingReaderShallowSeek(postingreader *r, int target) {
+    const postinglist *pl = r->list;
+    if (r->block < pl->numBlocks && pl->blocks[r->block].lastArticleId < target) {
+        int block = GallopToBlock(pl, r->block + 1, target);
+        r->cursor = pl->bytes + pl->blocks[block - 1].end;
+        r->article_id = pl->blocks[block - 1].lastArticleId;
+        r->block = block;
+    }
+}
+
+bool PostingReaderSeek(postingreader *r, int target, Posting *out) {
+    PostingReaderShallowSeek(r, target);
+    while (PostingReaderNext(r, out)) {
+        if (out->article_id >= target) return true;
+    }
+    return false;
+}
+
+int PostingReaderBlockMax(const postingreader *r) {
+    const postinglist *pl = r->list;
+    if (r->block < pl->numBlocks) return pl->blocks[r->block].maxCount;
+    int max = (r->cursor < r->end) ? pl->openMaxCount : 0;
+    return (r->tail.count > max) ? r->tail.count : max;
+}
+
+int PostingReaderBlockLast(const postingreader *r) {
+    const postinglist *pl = r->list;
+    if (r->block < pl->numBlocks) return pl->blocks[r->block].lastArticleId;
+    if (r->tail.count > 0) return r->tail.article_id;
+    return (r->cursor < r->end) ? pl->encodedArticleId : kNoMoreArticles;
+}
+
+void PostingReaderSkipBlock(postingreader *r) {
+    const postinglist *pl = r->list;
+    if (r->block < pl->numBlocks) {
+        r->cursor = pl->bytes + pl->blocks[r->block].end;
+        r->article_id = pl->blocks[r->block].lastArticleId;
+        r->block++;
+    } else {
+        r->cursor = r->end;
+        r->tail.count = 0;
+    }
+}
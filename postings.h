@@ -0,0 +1,239 @@
+#ifndef _postings_
+#define _postings_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <limits.h>
+#include "epoch.h"
+
+/* Posting of a word in an article */
+typedef struct {
+    int article_id;
+    int count;
+} Posting;
+
+/**
+ * Type: postinglist
+ * -----------------
+ * The postings of one word, sorted by increasing article_id and stored
+ * compressed: each posting is the gap from the previous article_id followed
+ * by the count, both as variable-byte integers (7 bits per byte, high bit
+ * set on every byte but the last).  Typical postings take two bytes instead
+ * of eight.
+ *
+ * Every kPostingsPerBlock encoded postings make up a block, and a small
+ * skip table records where each block ends, the last article_id in it and
+ * its largest count.  Since gaps restart from that article_id, a reader can
+ * jump straight to any block boundary, which is what lets PostingReaderSeek
+ * skip over the postings of articles it doesn't care about, and the counts
+ * let a top-k search skip blocks with nothing good enough in them (block-max
+ * WAND) without decoding them.
+ *
+ * The most recent posting is held back unencoded, so that repeated
+ * occurrences in the article being indexed only bump its count; it's
+ * encoded once a posting for a later article arrives.  Pretend the fields
+ * are private.  Lists mapped from a snapshot point at bytes and blocks they
+ * don't own, which they record by leaving allocated and blocksAllocated 0,
+ * and copy them the first time they need to grow.
+ *
+ * One thread may add to a list with PostingListAddShared while others read
+ * it through views (see PostingListView).  Added postings only ever go on
+ * the end, and the bytes and skip table are never moved or freed in place:
+ * when they grow, the old arrays are retired to an epoch, and the fields a
+ * view starts from are stored atomically, each only once what it leads to
+ * is in place.
+ */
+
+enum { kPostingsPerBlock = 64 };
+
+typedef struct {
+    int lastArticleId;
+    uint32_t end;            /* offset just past the block's last byte */
+    int maxCount;
+} postingblock;
+
+typedef struct {
+    uint8_t *bytes;
+    uint32_t length;
+    uint32_t allocated;
+    int encodedArticleId;    /* article_id of the last encoded posting, or -1 */
+    /* unencoded last posting; count 0 if none.  Aligned so that it can be
+       stored and loaded atomically, article_id and count together */
+    Posting tail __attribute__((aligned(8)));
+    int numPostings;         /* encoded + tail */
+    int maxCount;            /* largest count of any posting */
+    int openMaxCount;        /* largest count encoded since the last full block */
+    postingblock *blocks;    /* full blocks only */
+    int numBlocks;
+    int blocksAllocated;
+} postinglist;
+
+void PostingListNew(postinglist *pl);
+void PostingListDispose(postinglist *pl);
+
+/* Number of postings (that is, of distinct articles) */
+int PostingListLength(const postinglist *pl);
+
+/* Largest count of any posting, an upper bound on what the list can
+ * contribute to an article's score */
+int PostingListMaxCount(const postinglist *pl);
+
+/* Adds count occurrences in article_id, which must be no smaller than any
+ * article_id already in the list */
+void PostingListAdd(postinglist *pl, int article_id, int count);
+
+/* Same as PostingListAdd, for a list that views may be reading meanwhile:
+ * arrays the list outgrows go to reclaim rather than straight back to the
+ * heap, so readers that entered reclaim before the add can finish with them */
+void PostingListAddShared(postinglist *pl, int article_id, int count,
+                          epoch *reclaim);
+
+/**
+ * Function: PostingListView
+ * -------------------------
+ * Makes *view a read-only copy of pl's header, cut down to the postings of
+ * articles before limit, which can be read (with a postingreader, say)
+ * while a PostingListAddShared on another thread goes on adding to pl.
+ * The view shares pl's bytes and skip table, so it's good only as long as
+ * the caller stays inside the epoch those adds retire to; it's never
+ * disposed of or added to.  Every posting for an article before limit must
+ * already have been added: it's meant for limits like "the articles every
+ * shard is done with", not for cutting a list short.  Costs a decode of at
+ * most one block's worth of postings.
+ */
+
+void PostingListView(const postinglist *pl, int limit, postinglist *view);
+
+/**
+ * Type: postingimage
+ * ------------------
+ * A postinglist as stored in an index snapshot: everything but its bytes
+ * and skip table, which are saved elsewhere in the file and located by
+ * offset.  Every field has a fixed width and the layout has no padding, so
+ * 32- and 64-bit builds read the same files.
+ */
+
+typedef struct {
+    uint64_t bytesOffset;
+    uint64_t blocksOffset;
+    uint32_t length;
+    int32_t numBlocks;
+    int32_t encodedArticleId;
+    int32_t tailArticleId;
+    int32_t tailCount;
+    int32_t numPostings;
+    int32_t maxCount;
+    int32_t openMaxCount;
+} postingimage;
+
+/**
+ * Function: PostingListSave
+ * -------------------------
+ * Appends pl's bytes and skip table to out, each padded to 8 bytes, and
+ * describes pl in *image.  *offset is how far into the area shared by all
+ * lists out was on entry, and is advanced past what's written.  Returns
+ * false if writing failed.
+ */
+
+bool PostingListSave(const postinglist *pl, FILE *out, uint64_t *offset,
+                     postingimage *image);
+
+/**
+ * Function: PostingListMap
+ * ------------------------
+ * Makes pl a view of a list saved by PostingListSave, whose
+ * shared area is now the size bytes at (8-byte aligned) data.  Nothing is
+ * copied or decoded, so data must outlive pl, which needs disposing only
+ * once postings have been added to it.  Returns false, leaving pl empty,
+ * if image doesn't describe a list that fits in size bytes.
+ */
+
+bool PostingListMap(postinglist *pl, const postingimage *image,
+                    const uint8_t *data, uint64_t size);
+
+/**
+ * Type: postingreader
+ * -------------------
+ * Decodes a postinglist front to back, one posting at a time, without
+ * materializing it.  The list must not change while being read; read a
+ * view (PostingListView) of one that might.
+ *
+ *     postingreader r;
+ *     Posting p;
+ *     PostingReaderNew(&r, &entry->postings);
+ *     while (PostingReaderNext(&r, &p)) ...
+ *
+ * PostingReaderSeek moves forward to the first unread posting whose
+ * article_id is target or greater, galloping through the skip table and
+ * decoding only the block it lands in.  Reads and seeks can be mixed
+ * freely.
+ *
+ * The postings after the last full block, tail included, count as one more
+ * (open) block as far as the block functions below are concerned.
+ */
+
+typedef struct {
+    const postinglist *list;
+    const uint8_t *cursor;
+    const uint8_t *end;
+    int article_id;          /* last one decoded */
+    int block;               /* block the cursor is in (numBlocks past them) */
+    Posting tail;
+} postingreader;
+
+/* Article id that compares greater than every real one */
+enum { kNoMoreArticles = INT_MAX };
+
+void PostingReaderNew(postingreader *r, const postinglist *pl);
+static inline bool PostingReaderNext(postingreader *r, Posting *out);
+bool PostingReaderSeek(postingreader *r, int target, Posting *out);
+
+/* Largest count and last article_id of the block holding the next unread
+ * posting; 0 and kNoMoreArticles once there are none */
+int PostingReaderBlockMax(const postingreader *r);
+int PostingReaderBlockLast(const postingreader *r);
+
+/* Discards the unread postings of the block holding the next one */
+void PostingReaderSkipBlock(postingreader *r);
+
+/* Moves forward to the start of the block that would hold target, decoding
+ * nothing, so the two functions above describe the postings near target */
+void PostingReaderShallowSeek(postingreader *r, int target);
+
+/* PostingReaderNext is inline because query loops call it once per posting:
+ * out-of-line, the posting makes a round trip through memory that costs
+ * more than decoding it */
+
+static inline uint32_t PostingGetVarint(const uint8_t **cursor) {
+    const uint8_t *p = *cursor;
+    uint32_t value = 0;
+    int shift = 0;
+    while (*p & 0x80) {
+        value |= (uint32_t)(*p++ & 0x7F) << shift;
+        shift += 7;
+    }
+    value |= (uint32_t)*p++ << shift;
+    *cursor = p;
+    return value;
+}
+
+static inline bool PostingReaderNext(postingreader *r, Posting *out) {
+    if (r->cursor < r->end) {
+        r->article_id += (int)PostingGetVarint(&r->cursor);
+        out->article_id = r->article_id;
+        out->count = (int)PostingGetVarint(&r->cursor);
+        const postinglist *pl = r->list;
+        if (r->block < pl->numBlocks && r->cursor == pl->bytes + pl->blocks[r->block].end)
+            r->block++;
+        return true;
+    }
+    if (r->tail.count > 0) {
+        *out = r->tail;
+        r->tail.count = 0;
+        return true;
+    }
+    return false;
+}
+
+#endif
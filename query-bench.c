@@ -0,0 +1,176 @@
+/* query-bench.c
+ *
+ * Latency benchmark for IndexQueryTopN.  It builds a synthetic index whose
+ * term frequencies follow Zipf's law, as the words of real articles do, so
+ * that the most common terms appear in nearly every article and the rarest
+ * in only a handful.  Then it times queries against terms spread across
+ * that range and reports per-query latency by document frequency, followed
+ * by a few multi-word IndexQuery queries over the same terms.
+ *
+ *   ./query-bench [-a articles] [-w words-per-article] [-t top-n] [-n iterations] [-b]
+ *
+ * -b ranks by BM25 instead of raw counts.
+ */
+
+#define _XOPEN_SOURCE 700
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "index.h"
+
+static const int kDefaultArticles = 100000;
+static const int kDefaultWordsPerArticle = 200;
+static const int kDefaultTopN = 10;
+static const int kDefaultIterations = 200;
+static const int kVocabularySize = 50000;
+
+static double Now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Draws term ranks from a Zipf distribution by binary search of its CDF */
+static double *gCDF = NULL;
+
+static void BuildZipfCDF(int n) {
+  gCDF = malloc(n * sizeof(double));
+  assert(gCDF != NULL);
+  double sum = 0;
+  for (int i = 0; i < n; i++) gCDF[i] = (sum += 1.0 / (i + 1));
+  for (int i = 0; i < n; i++) gCDF[i] /= sum;
+}
+
+static int DrawRank(int n) {
+  double u = (double)rand() / ((double)RAND_MAX + 1);
+  int lo = 0, hi = n - 1;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (gCDF[mid] < u) lo = mid + 1; else hi = mid;
+  }
+  return lo;
+}
+
+/* document frequency of each term rank, tallied while building the index */
+static int *gDocFrequency = NULL;
+
+static void TermName(int rank, char *buffer, size_t size) {
+  snprintf(buffer, size, "term%d", rank);
+}
+
+static index_t *BuildIndex(int numArticles, int wordsPerArticle) {
+  index_t *idx = IndexCreate(0);
+  assert(idx != NULL);
+  char url[64], term[32];
+  int *lastArticle = malloc(kVocabularySize * sizeof(int));
+  gDocFrequency = calloc(kVocabularySize, sizeof(int));
+  assert(lastArticle != NULL && gDocFrequency != NULL);
+  for (int r = 0; r < kVocabularySize; r++) lastArticle[r] = -1;
+  for (int a = 0; a < numArticles; a++) {
+    snprintf(url, sizeof(url), "http://bench.example/%d", a);
+    int id = IndexRegisterArticle(idx, url, url);
+    int length = wordsPerArticle / 2 + rand() % (wordsPerArticle + 1);
+    for (int w = 0; w < length; w++) {
+      int rank = DrawRank(kVocabularySize);
+      if (lastArticle[rank] != id) {
+        lastArticle[rank] = id;
+        gDocFrequency[rank]++;
+      }
+      TermName(rank, term, sizeof(term));
+      IndexAddToken(idx, id, term);
+    }
+  }
+  free(lastArticle);
+  return idx;
+}
+
+static int CompareDoubles(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+/* Times iterations runs of a query: the word itself if rank >= 0, and
+ * IndexQuery on text otherwise */
+static void TimeQuery(index_t *idx, int rank, const char *text, int topN,
+                      int iterations) {
+  char term[32];
+  if (rank >= 0) TermName(rank, term, sizeof(term));
+  double *samples = malloc(iterations * sizeof(double));
+  assert(samples != NULL);
+
+  double total = 0;
+  for (int i = 0; i < iterations; i++) {
+    vector results;
+    double start = Now();
+    if (rank >= 0) IndexQueryTopN(idx, term, topN, &results);
+    else IndexQuery(idx, text, topN, &results, NULL);
+    samples[i] = (Now() - start) * 1e6;
+    total += samples[i];
+    VectorDispose(&results);
+  }
+  qsort(samples, iterations, sizeof(double), CompareDoubles);
+
+  char label[64];
+  if (rank >= 0) snprintf(label, sizeof(label), "%-10s df %8d", term, gDocFrequency[rank]);
+  else snprintf(label, sizeof(label), "%s", text);
+  printf("%-28s  mean %9.1f us  p50 %9.1f us  p99 %9.1f us\n", label,
+         total / iterations, samples[iterations / 2],
+         samples[(int)(iterations * 0.99)]);
+  free(samples);
+}
+
+int main(int argc, char **argv) {
+  int numArticles = kDefaultArticles, wordsPerArticle = kDefaultWordsPerArticle;
+  int topN = kDefaultTopN, iterations = kDefaultIterations;
+  rankingmode ranking = kRankByCount;
+  int opt;
+  while ((opt = getopt(argc, argv, "a:w:t:n:b")) != -1) {
+    switch (opt) {
+    case 'a': numArticles = atoi(optarg); break;
+    case 'w': wordsPerArticle = atoi(optarg); break;
+    case 't': topN = atoi(optarg); break;
+    case 'n': iterations = atoi(optarg); break;
+    case 'b': ranking = kRankByBM25; break;
+    default:
+      fprintf(stderr, "Usage: %s [-a articles] [-w words-per-article] "
+              "[-t top-n] [-n iterations] [-b]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (numArticles <= 0 || wordsPerArticle <= 0 || topN <= 0 || iterations <= 0) {
+    fprintf(stderr, "All arguments must be positive.\n");
+    return 1;
+  }
+
+  srand(107);
+  BuildZipfCDF(kVocabularySize);
+  double start = Now();
+  index_t *idx = BuildIndex(numArticles, wordsPerArticle);
+  printf("%d articles, %d words each, indexed in %.2f s; top %d by %s, %d iterations\n",
+         numArticles, wordsPerArticle, Now() - start, topN,
+         (ranking == kRankByBM25) ? "BM25" : "count", iterations);
+  IndexSetRanking(idx, ranking);
+  vector warmup;   /* the first query computes the BM25 length norms */
+  IndexQueryTopN(idx, "term0", topN, &warmup);
+  VectorDispose(&warmup);
+
+  /* most common terms first, then ever rarer ones */
+  const int kRanks[] = {0, 1, 9, 99, 999, 9999};
+  for (int i = 0; i < sizeof(kRanks) / sizeof(kRanks[0]); i++)
+    TimeQuery(idx, kRanks[i], NULL, topN, iterations);
+
+  const char *const kQueries[] = {
+    "term0 AND term9999", "term1 AND term99", "term9 AND term99 AND term999",
+    "term1 NOT term9", "term99 term999", "term0 term1 term9",
+  };
+  for (int i = 0; i < sizeof(kQueries) / sizeof(kQueries[0]); i++)
+    TimeQuery(idx, -1, kQueries[i], topN, iterations);
+
+  IndexDestroy(idx);
+  free(gCDF);
+  free(gDocFrequency);
+  return 0;
+}
@@ -0,0 +1,364 @@
+/* query.c
+ *
+ * Queries are evaluated document-at-a-time: every clause keeps its own
+ * cursor into the postings of each of its words, and the next candidate
+ * article is the smallest one any (essential) clause matches.  Giving
+ * each clause private cursors means a word shared by two clauses is
+ * decoded twice, but it keeps each clause's cursors parked on the article
+ * it last matched, where its counts can be read off.
+ */
+
+#include "query.h"
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+
+static const char *const kWhiteSpace = " \t\r\n";
+
+bool QueryIsCompound(const char *text) {
+    int words = 0;
+    const char *p = text;
+    while (*(p += strspn(p, kWhiteSpace)) != '\0') {
+        size_t n = strcspn(p, kWhiteSpace);
+        if ((n == 3 && (strncmp(p, "AND", 3) == 0 || strncmp(p, "NOT", 3) == 0)) ||
+            (n == 2 && strncmp(p, "OR", 2) == 0))
+            return true;
+        if (++words > 1) return true;
+        p += n;
+    }
+    return false;
+}
+
+static int InternTerm(query *q, char *word) {
+    for (char *p = word; *p != '\0'; p++) *p = (char)tolower((unsigned char)*p);
+    for (int i = 0; i < q->numTerms; i++)
+        if (strcmp(q->terms[i], word) == 0) return i;
+    if (q->numTerms == kMaxQueryTerms) return -1;
+    q->terms[q->numTerms] = word;
+    return q->numTerms++;
+}
+
+const char *QueryParse(query *q, const char *text) {
+    q->text = strdup(text);
+    assert(q->text != NULL);
+    q->numTerms = 0;
+    q->numClauses = 0;
+
+    const char *error = NULL;
+    bool pendingAnd = false, pendingOr = false, negate = false, expectingWord = false;
+    char *saveptr;
+    for (char *word = strtok_r(q->text, kWhiteSpace, &saveptr); word != NULL && error == NULL;
+         word = strtok_r(NULL, kWhiteSpace, &saveptr)) {
+        if (strcmp(word, "AND") == 0 || strcmp(word, "OR") == 0) {
+            if (q->numClauses == 0 || expectingWord) error = "AND and OR need a word on either side.";
+            pendingAnd = (word[0] == 'A');
+            pendingOr = !pendingAnd;
+            expectingWord = true;
+        } else if (strcmp(word, "NOT") == 0) {
+            if (negate) error = "NOT must be followed by a word.";
+            negate = expectingWord = true;
+        } else {
+            int term = InternTerm(q, word);
+            if (term < 0) {
+                error = "Too many different words in one query.";
+                break;
+            }
+            bool joinCurrent = q->numClauses > 0 && !pendingOr && (pendingAnd || negate);
+            if (!joinCurrent) {
+                if (q->numClauses > 0 && q->clauses[q->numClauses - 1].required == 0) {
+                    error = "NOT needs a word to exclude from.";
+                    break;
+                }
+                if (q->numClauses == kMaxQueryClauses) {
+                    error = "Too many OR'd alternatives in one query.";
+                    break;
+                }
+                q->clauses[q->numClauses].required = q->clauses[q->numClauses].excluded = 0;
+                q->numClauses++;
+            }
+            queryclause *clause = &q->clauses[q->numClauses - 1];
+            if (negate) clause->excluded |= 1u << term;
+            else clause->required |= 1u << term;
+            pendingAnd = pendingOr = negate = expectingWord = false;
+        }
+    }
+
+    if (error == NULL && expectingWord) error = "The query ends with an operator.";
+    if (error == NULL && q->numClauses == 0) error = "The query is empty.";
+    if (error == NULL && q->clauses[q->numClauses - 1].required == 0)
+        error = "NOT needs a word to exclude from.";
+    if (error != NULL) QueryDispose(q);
+    return error;
+}
+
+void QueryDispose(query *q) {
+    free(q->text);
+    q->text = NULL;
+}
+
+void QueryIgnoreTerm(query *q, int term) {
+    assert(term >= 0 && term < q->numTerms);
+    for (int i = 0; i < q->numClauses; i++) {
+        q->clauses[i].required &= ~(1u << term);
+        q->clauses[i].excluded &= ~(1u << term);
+    }
+}
+
+/* ----------------------- Evaluation ------------------------------------ */
+
+typedef struct {
+    int term;
+    double weight;           /* see ranking.h */
+    postingreader reader;
+    Posting current;         /* -1 before the first seek */
+} termcursor;
+
+/* Returns the article_id of the first posting at or after target */
+static int TermSeek(termcursor *tc, int target) {
+    if (tc->current.article_id < target &&
+        !PostingReaderSeek(&tc->reader, target, &tc->current))
+        tc->current.article_id = kNoMoreArticles;
+    return tc->current.article_id;
+}
+
+typedef struct {
+    termcursor *required;    /* rarest word first */
+    int numRequired;
+    termcursor *excluded;
+    int numExcluded;
+    uint32_t requiredTerms;
+    double upperBound;       /* sum of the required words' best scores */
+    int next;                /* first match at or after the last target */
+} clausecursor;
+
+/* Returns the first article at or after target that the clause matches,
+ * leaving its required cursors on it */
+static int ClauseSeek(clausecursor *cc, int target) {
+    if (cc->next >= target) return cc->next;
+    int candidate = target;
+    while (true) {
+        /* leapfrog: whenever a word's next article lies beyond the
+           candidate, it becomes the candidate and the others catch up */
+        int agreeing = 0;
+        for (int i = 0; agreeing < cc->numRequired; i = (i + 1) % cc->numRequired) {
+            int id = TermSeek(&cc->required[i], candidate);
+            if (id == kNoMoreArticles) return cc->next = kNoMoreArticles;
+            if (id > candidate) {
+                candidate = id;
+                agreeing = 1;
+            } else {
+                agreeing++;
+            }
+        }
+
+        bool vetoed = false;
+        for (int i = 0; i < cc->numExcluded && !vetoed; i++)
+            vetoed = TermSeek(&cc->excluded[i], candidate) == candidate;
+        if (!vetoed) return cc->next = candidate;
+        candidate++;
+    }
+}
+
+static int CompareRarity(const void *a, const void *b) {
+    const termcursor *ta = a, *tb = b;
+    return PostingListLength(ta->reader.list) - PostingListLength(tb->reader.list);
+}
+
+static int CompareUpperBounds(const void *a, const void *b) {
+    const clausecursor *ca = a, *cb = b;
+    return (ca->upperBound > cb->upperBound) - (ca->upperBound < cb->upperBound);
+}
+
+/* Builds cursors for every clause that can match anything, cheapest to
+ * skip first; returns how many */
+static int OpenClauses(const query *q, const postinglist *const lists[],
+                       const ranking *rk, clausecursor *clauses, termcursor *cursors) {
+    int numClauses = 0;
+    for (int c = 0; c < q->numClauses; c++) {
+        uint32_t required = q->clauses[c].required, excluded = q->clauses[c].excluded;
+        bool possible = required != 0;
+        for (uint32_t m = required; m != 0 && possible; m &= m - 1)
+            possible = lists[__builtin_ctz(m)] != NULL;
+        if (!possible) continue;
+
+        clausecursor *cc = &clauses[numClauses++];
+        cc->required = cursors;
+        cc->numRequired = 0;
+        cc->requiredTerms = required;
+        cc->upperBound = 0;
+        cc->next = -1;
+        for (uint32_t m = required; m != 0; m &= m - 1) {
+            termcursor *tc = &cc->required[cc->numRequired++];
+            tc->term = __builtin_ctz(m);
+            tc->weight = RankingWeight(rk, PostingListLength(lists[tc->term]));
+            PostingReaderNew(&tc->reader, lists[tc->term]);
+            tc->current.article_id = -1;
+            cc->upperBound += RankingBound(rk, tc->weight, PostingListMaxCount(lists[tc->term]));
+        }
+        qsort(cc->required, cc->numRequired, sizeof(termcursor), CompareRarity);
+
+        cc->excluded = cc->required + cc->numRequired;
+        cc->numExcluded = 0;
+        for (uint32_t m = excluded; m != 0; m &= m - 1) {
+            int term = __builtin_ctz(m);
+            if (lists[term] == NULL) continue;
+            termcursor *tc = &cc->excluded[cc->numExcluded++];
+            tc->term = term;
+            PostingReaderNew(&tc->reader, lists[term]);
+            tc->current.article_id = -1;
+        }
+        cursors = cc->excluded + cc->numExcluded;
+    }
+    qsort(clauses, numClauses, sizeof(clausecursor), CompareUpperBounds);
+    return numClauses;
+}
+
+/* What each word matched so far contributes to the candidate */
+typedef struct {
+    uint32_t matched;
+    int counts[kMaxQueryTerms];
+    double scores[kMaxQueryTerms];
+} tally;
+
+/* Notes the words of a clause that matched, where its cursors sit */
+static void Credit(const clausecursor *cc, const ranking *rk, tally *t) {
+    for (int i = 0; i < cc->numRequired; i++) {
+        const termcursor *tc = &cc->required[i];
+        t->counts[tc->term] = tc->current.count;
+        t->scores[tc->term] = RankingScore(rk, tc->weight, tc->current.count,
+                                           tc->current.article_id);
+    }
+    t->matched |= cc->requiredTerms;
+}
+
+static double Score(const tally *t) {
+    double score = 0;
+    for (uint32_t m = t->matched; m != 0; m &= m - 1) score += t->scores[__builtin_ctz(m)];
+    return score;
+}
+
+static int Count(const tally *t) {
+    int count = 0;
+    for (uint32_t m = t->matched; m != 0; m &= m - 1) count += t->counts[__builtin_ctz(m)];
+    return count;
+}
+
+/* Upper bound on the word's score in any article from target through *last
+ * (which it sets), going by the block maxima alone; 0 if it occurs in none */
+static double TermBlockBound(termcursor *tc, const ranking *rk, int target, int *last) {
+    if (tc->current.article_id == kNoMoreArticles) {
+        *last = kNoMoreArticles;
+        return 0;
+    }
+    if (tc->current.article_id < target) PostingReaderShallowSeek(&tc->reader, target);
+    int max = PostingReaderBlockMax(&tc->reader);
+    *last = PostingReaderBlockLast(&tc->reader);
+    if (*last < target && tc->current.article_id < target) {   /* none left */
+        *last = kNoMoreArticles;
+        return 0;
+    }
+    if (tc->current.article_id >= target && tc->current.count > max) max = tc->current.count;
+    return RankingBound(rk, tc->weight, max);
+}
+
+/* The same for a clause, whose words must all occur */
+static double ClauseBlockBound(clausecursor *cc, const ranking *rk, int target, int *last) {
+    *last = kNoMoreArticles;
+    if (cc->next == kNoMoreArticles) return 0;
+    double bound = 0;
+    for (int i = 0; i < cc->numRequired; i++) {
+        int termLast;
+        double termBound = TermBlockBound(&cc->required[i], rk, target, &termLast);
+        if (termBound == 0) {   /* the word has no postings left */
+            *last = kNoMoreArticles;
+            return 0;
+        }
+        bound += termBound;
+        if (termLast < *last) *last = termLast;
+    }
+    return bound;
+}
+
+/* Upper bound on the score of any article from target through *last */
+static double WindowBound(clausecursor *clauses, int numClauses, const ranking *rk,
+                          int target, int *last) {
+    *last = kNoMoreArticles;
+    double bound = 0;
+    for (int i = 0; i < numClauses; i++) {
+        int clauseLast;
+        bound += ClauseBlockBound(&clauses[i], rk, target, &clauseLast);
+        if (clauseLast < *last) *last = clauseLast;
+    }
+    return bound;
+}
+
+void QueryRun(const query *q, const postinglist *const lists[], const ranking *rk,
+              topn *best) {
+    clausecursor clauses[kMaxQueryClauses];
+    int numCursors = 0;
+    for (int c = 0; c < q->numClauses; c++)
+        numCursors += __builtin_popcount(q->clauses[c].required) +
+                      __builtin_popcount(q->clauses[c].excluded);
+    termcursor *cursors = malloc(numCursors * sizeof(termcursor) + 1);
+    assert(cursors != NULL);
+    int numClauses = OpenClauses(q, lists, rk, clauses, cursors);
+
+    /* bound[i] is the most clauses 0..i can add to any article's score */
+    double bound[kMaxQueryClauses], sum = 0;
+    for (int i = 0; i < numClauses; i++) bound[i] = (sum += clauses[i].upperBound);
+
+    /* clauses below firstEssential can't make an article good enough on
+       their own, so they never nominate candidates, only score them */
+    int firstEssential = 0, target = 0;
+    int checkedThrough = -1;
+    double checkedThreshold = 0;
+    while (true) {
+        double threshold = TopNThreshold(best);
+        while (firstEssential < numClauses && bound[firstEssential] <= threshold)
+            firstEssential++;
+        if (firstEssential == numClauses) break;
+
+        /* block-max WAND: skip every run of articles that couldn't beat
+           the threshold even if each word occurred as often as it does
+           anywhere in the block around them.  Later articles lose ties, so
+           matching the threshold isn't enough. */
+        if (threshold > 0 && (target > checkedThrough || threshold != checkedThreshold)) {
+            int last;
+            while (WindowBound(clauses, numClauses, rk, target, &last) <= threshold) {
+                target = (last == kNoMoreArticles) ? kNoMoreArticles : last + 1;
+                if (target == kNoMoreArticles) break;
+            }
+            if (target == kNoMoreArticles) break;
+            checkedThrough = last;
+            checkedThreshold = threshold;
+        }
+
+        int candidate = kNoMoreArticles;
+        for (int i = firstEssential; i < numClauses; i++) {
+            int id = ClauseSeek(&clauses[i], target);
+            if (id < candidate) candidate = id;
+        }
+        if (candidate == kNoMoreArticles) break;
+
+        tally t;
+        t.matched = 0;
+        for (int i = firstEssential; i < numClauses; i++)
+            if (clauses[i].next == candidate) Credit(&clauses[i], rk, &t);
+        double score = Score(&t);
+        for (int i = firstEssential - 1; i >= 0 && score + bound[i] > threshold; i--) {
+            if (ClauseSeek(&clauses[i], candidate) == candidate) {
+                Credit(&clauses[i], rk, &t);
+                score = Score(&t);
+            }
+        }
+
+        result_t r;
+        r.article_id = candidate;
+        r.count = Count(&t);
+        r.score = score;
+        TopNOffer(best, &r);
+        target = candidate + 1;
+    }
+    free(cursors);
+}
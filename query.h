@@ -0,0 +1,79 @@
+#ifndef _query_
+#define _query_
+
+#include "topn.h"        /* first: vector.h's bool must precede stdbool.h */
+#include "postings.h"
+#include "ranking.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Type: query
+ * -----------
+ * A parsed multi-word query.  Queries are words separated by white space,
+ * optionally joined by the (upper case) operators AND, OR and NOT:
+ *
+ *     climate policy              articles with either word
+ *     climate AND policy          articles with both
+ *     climate NOT sports          articles with climate but not sports
+ *     climate AND policy OR un    (climate AND policy) OR un
+ *
+ * NOT binds tightest, then AND, then OR; words with no operator between
+ * them are OR'd, so a plain list of words is a ranked "any of these"
+ * search.  Internally a query is a disjunction of clauses, each a set of
+ * required words and a set of excluded ones.  An article's score is the
+ * sum of the scores (see ranking.h) of the required words of every clause
+ * it satisfies.
+ * Pretend the fields are private.
+ */
+
+enum { kMaxQueryTerms = 32, kMaxQueryClauses = 16 };
+
+typedef struct {
+    uint32_t required;       /* bit i set if terms[i] must occur */
+    uint32_t excluded;       /* bit i set if terms[i] mustn't */
+} queryclause;
+
+typedef struct {
+    char *text;              /* lowercased copy; terms point into it */
+    const char *terms[kMaxQueryTerms];   /* distinct words */
+    int numTerms;
+    queryclause clauses[kMaxQueryClauses];
+    int numClauses;
+} query;
+
+/**
+ * Function: QueryParse
+ * --------------------
+ * Parses text into q.  Returns NULL on success, in which case q must
+ * eventually be passed to QueryDispose, or a static description of what's
+ * wrong with the query otherwise (and q needs no disposing).
+ */
+
+const char *QueryParse(query *q, const char *text);
+void QueryDispose(query *q);
+
+/* Returns true if text uses any operator or has more than one word */
+bool QueryIsCompound(const char *text);
+
+/* Removes every occurrence of a term (a stop word, say) from q, as if it
+ * had never been typed */
+void QueryIgnoreTerm(query *q, int term);
+
+/**
+ * Function: QueryRun
+ * ------------------
+ * Offers every article matching q to best, scored as described above.
+ * lists[i] holds the postings of q->terms[i], or NULL if no article
+ * contains it, and rk says how to score them.  Required words are
+ * intersected by seeking each list to the article the others agree on,
+ * and once best is full, clauses whose words can't add up to enough to
+ * displace its worst result are only consulted for articles that other
+ * clauses have already matched (the MaxScore strategy), and the search ends
+ * as soon as no clause can.
+ */
+
+void QueryRun(const query *q, const postinglist *const lists[], const ranking *rk,
+              topn *best);
+
+#endif
@@ -0,0 +1,283 @@
+/* queryserver.c
+ *
+ * The listener thread only accepts; each connection gets a detached thread
+ * that reads whatever the client has sent so far into a buffer, answers
+ * every complete line in it, and flushes the answers in one write before
+ * reading again.  A client that pipelines many queries thus gets them back
+ * in a few large writes, and one that sends a query at a time still gets
+ * each answer as soon as it's ready.  Lines may be up to kMaxLine bytes
+ * long; the buffer doubles as needed until then, and a line that doesn't
+ * fit is answered with an error as soon as the buffer fills, its first
+ * kMaxLine bytes standing in for the query, and the rest of it is read
+ * and dropped.  At most kMaxClients connections are served at once; the
+ * listener stops accepting until one of them ends, leaving any others in
+ * the socket's backlog.  SIGPIPE is ignored, so a client that hangs up
+ * early only makes its own flush fail.
+ */
+
+#include "queryserver.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+enum { kInitialLine = 4096, kMaxLine = 1 << 16, kMaxClients = 256 };
+
+static const char *const kDefaultHost = "127.0.0.1";
+
+/* Writes s as a JSON string, quotes included.  Bytes outside ASCII pass
+ * through untouched */
+static void PutJSONString(const char *s, FILE *out) {
+    putc('"', out);
+    for (; *s != '\0'; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            putc('\\', out);
+            putc(c, out);
+        } else if (c == '\n') {
+            fputs("\\n", out);
+        } else if (c == '\t') {
+            fputs("\\t", out);
+        } else if (c < 0x20) {
+            fprintf(out, "\\u%04x", c);
+        } else {
+            putc(c, out);
+        }
+    }
+    putc('"', out);
+}
+
+void QueryServerAnswer(index_t *idx, const char *text, int topN, FILE *out) {
+    vector results;
+    const char *error;
+    int found = IndexQuery(idx, text, topN, &results, &error);
+
+    fputs("{\"query\":", out);
+    PutJSONString(text, out);
+    if (found < 0) {
+        fputs(",\"error\":", out);
+        PutJSONString(error, out);
+    } else {
+        fprintf(out, ",\"found\":%d,\"results\":[", found);
+        for (int i = 0; i < found; i++) {
+            result_t *r = (result_t *)VectorNth(&results, i);
+            const char *title = IndexGetArticleTitle(idx, r->article_id);
+            const char *url = IndexGetArticleURL(idx, r->article_id);
+            fprintf(out, "%s{\"article\":%d,\"title\":", (i > 0) ? "," : "", r->article_id);
+            PutJSONString(title ? title : "", out);
+            fputs(",\"url\":", out);
+            PutJSONString(url ? url : "", out);
+            fprintf(out, ",\"count\":%d,\"score\":%.6g}", r->count, r->score);
+        }
+        putc(']', out);
+    }
+    fputs("}\n", out);
+    VectorDispose(&results);
+}
+
+/* What every client's thread shares: the index, and the count of clients
+ * being served, which the listener waits on when it reaches kMaxClients */
+typedef struct {
+    index_t *idx;
+    int topN;
+    int numClients;
+    pthread_mutex_t lock;
+    pthread_cond_t clientLeft;
+} server;
+
+typedef struct {
+    server *s;
+    int fd;
+} client;
+
+/* Serves one connection until the client hangs up or can't be written to */
+static void *ServeClient(void *aux) {
+    client *c = aux;
+    server *s = c->s;
+    FILE *out = fdopen(c->fd, "w");
+    size_t capacity = kInitialLine, length = 0;
+    char *buffer = malloc(capacity + 1);    /* + 1 for an unterminated last line */
+    assert(buffer != NULL);
+    bool skipping = false;                  /* through an over-long line */
+    while (out != NULL) {
+        if (length == capacity) {
+            if (capacity == kMaxLine) {
+                buffer[length] = '\0';
+                fputs("{\"query\":", out);
+                PutJSONString(buffer, out);
+                fputs(",\"error\":\"The query is too long.\"}\n", out);
+                skipping = true;
+                length = 0;
+            } else {
+                capacity *= 2;
+                buffer = realloc(buffer, capacity + 1);
+                assert(buffer != NULL);
+            }
+        }
+        ssize_t n = read(c->fd, buffer + length, capacity - length);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            if (n == 0 && length > 0 && !skipping) {
+                buffer[length] = '\0';
+                QueryServerAnswer(s->idx, buffer, s->topN, out);
+            }
+            break;
+        }
+        length += n;
+
+        char *line = buffer, *newline;
+        if (skipping) {
+            newline = memchr(buffer, '\n', length);
+            skipping = (newline == NULL);
+            line = skipping ? buffer + length : newline + 1;
+        }
+        while ((newline = memchr(line, '\n', buffer + length - line)) != NULL) {
+            *newline = '\0';
+            if (newline > line && newline[-1] == '\r') newline[-1] = '\0';
+            QueryServerAnswer(s->idx, line, s->topN, out);
+            line = newline + 1;
+        }
+        length -= line - buffer;
+        memmove(buffer, line, length);
+        if (fflush(out) != 0) break;
+    }
+    if (out != NULL) fclose(out);    /* closes c->fd */
+    else close(c->fd);
+    free(buffer);
+    free(c);
+
+    pthread_mutex_lock(&s->lock);
+    s->numClients--;
+    pthread_cond_signal(&s->clientLeft);
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+static int ListenUnix(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    return fd;
+}
+
+/* Returns -1 with *problem set to why; errno says more unless it's a
+ * getaddrinfo error, whose description *problem then is */
+static int ListenTCP(const char *address, const char **problem) {
+    char *copy = strdup(address);
+    assert(copy != NULL);
+    const char *host = kDefaultHost, *port = copy;
+    char *colon = strrchr(copy, ':');
+    if (colon != NULL) {
+        *colon = '\0';
+        if (colon > copy) host = copy;
+        port = colon + 1;
+    }
+
+    struct addrinfo hints, *addrs;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    int status = getaddrinfo(host, port, &hints, &addrs);
+    free(copy);
+    if (status != 0) {
+        *problem = gai_strerror(status);
+        return -1;
+    }
+
+    int fd = -1;
+    *problem = NULL;
+    for (struct addrinfo *a = addrs; a != NULL && fd < 0; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd < 0) continue;
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (bind(fd, a->ai_addr, a->ai_addrlen) != 0 || listen(fd, SOMAXCONN) != 0) {
+            int saved = errno;
+            close(fd);
+            errno = saved;
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addrs);
+    return fd;
+}
+
+int QueryServerListen(const char *address) {
+    const char *problem = NULL;
+    int fd = (strchr(address, '/') != NULL) ? ListenUnix(address)
+                                            : ListenTCP(address, &problem);
+    if (fd < 0)
+        fprintf(stderr, "Couldn't listen on \"%s\": %s\n", address,
+                problem ? problem : strerror(errno));
+    return fd;
+}
+
+void QueryServerRun(index_t *idx, int listener, int topN) {
+    signal(SIGPIPE, SIG_IGN);
+    server s;
+    s.idx = idx;
+    s.topN = topN;
+    s.numClients = 0;
+    pthread_mutex_init(&s.lock, NULL);
+    pthread_cond_init(&s.clientLeft, NULL);
+    pthread_attr_t detached;
+    pthread_attr_init(&detached);
+    pthread_attr_setdetachstate(&detached, PTHREAD_CREATE_DETACHED);
+    while (true) {
+        pthread_mutex_lock(&s.lock);
+        while (s.numClients == kMaxClients)
+            pthread_cond_wait(&s.clientLeft, &s.lock);
+        pthread_mutex_unlock(&s.lock);
+
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0) {
+            /* out of descriptors, say: give clients a moment to hang up */
+            if (errno != EINTR && errno != ECONNABORTED) usleep(100000);
+            continue;
+        }
+        int on = 1;    /* answers go out whole; don't hold them back */
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        client *c = malloc(sizeof(client));
+        assert(c != NULL);
+        c->s = &s;
+        c->fd = fd;
+        pthread_mutex_lock(&s.lock);
+        s.numClients++;
+        pthread_mutex_unlock(&s.lock);
+        pthread_t thread;
+        if (pthread_create(&thread, &detached, ServeClient, c) != 0) {
+            close(fd);
+            free(c);
+            pthread_mutex_lock(&s.lock);
+            s.numClients--;
+            pthread_mutex_unlock(&s.lock);
+        }
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef QUERYSERVER_H
+#define QUERYSERVER_H
+
+#include "index.h"       /* first: vector.h's bool must precede stdbool.h */
+#include <stdbool.h>
+#include <stdio.h>
+
+/* Long-lived query service over a socket, for programs rather than people.
+ * The protocol is one query per line (the same syntax as IndexQuery) in,
+ * one line of JSON per line out, in the same order:
+ *
+ *     climate AND policy
+ *     {"query":"climate AND policy","found":2,"results":[{"article":17,
+ *      "title":"...","url":"...","count":5,"score":5},...]}
+ *
+ *     climate AND
+ *     {"query":"climate AND","error":"..."}
+ *
+ * (each answer is really on a single line).  Every line gets exactly one
+ * answer, even a blank one (an error), so clients can pair them up by
+ * counting.  Clients may pipeline: send any number of queries without
+ * waiting, and read the answers as they come.  A line too long to be a
+ * query (over 64 KB) gets an error like any other bad query.  Up to 256
+ * clients are served at once, each on a thread of its own (more wait to be
+ * accepted), and queries never wait on each other or on an index that's
+ * still growing (see index.h). */
+
+/* Writes the JSON answer to text, as described above, as one line of out */
+void QueryServerAnswer(index_t *idx, const char *text, int topN, FILE *out);
+
+/* Opens a socket listening on address, and returns it, or -1 (having said
+ * why on stderr) if that can't be done.  An address with a '/' in it is the
+ * path of a Unix domain socket, replacing a stale one (but no other kind of
+ * file); anything else is "[host:]port", host defaulting to 127.0.0.1, so
+ * that a bare port is reachable only from this machine.  Separate from
+ * QueryServerRun so that a bad address shows up before a long crawl */
+int QueryServerListen(const char *address);
+
+/* Answers every client that connects to listener with the topN best
+ * articles of idx, as described above.  Never returns */
+void QueryServerRun(index_t *idx, int listener, int topN);
+
+#endif // QUERYSERVER_H
@@ -0,0 +1,29 @@
+/* ranking.c
+ *
+ * BM25 as in Robertson and Zaragoza, "The Probabilistic Relevance
+ * Framework", with the idf smoothed as Lucene does so that it stays
+ * positive even for words in more than half of all articles.
+ */
+
+#include "ranking.h"
+#include <math.h>
+
+static const double kK1 = 1.2;
+static const double kB = 0.75;
+static const double kBoundSlack = 1 + 1e-9;
+
+float RankingLengthNorm(int length, double avgLength) {
+    if (avgLength <= 0) avgLength = 1;
+    return (float)(kK1 * (1 - kB + kB * length / avgLength));
+}
+
+double RankingWeight(const ranking *rk, int docFrequency) {
+    if (rk->mode == kRankByCount) return 1;
+    double idf = log(1 + (rk->numArticles - docFrequency + 0.5) / (docFrequency + 0.5));
+    return idf * (kK1 + 1);
+}
+
+double RankingBound(const ranking *rk, double weight, int maxCount) {
+    if (rk->mode == kRankByCount) return maxCount;
+    return weight * maxCount / (maxCount + rk->minLengthNorm) * kBoundSlack;
+}
@@ -0,0 +1,47 @@
+#ifndef _ranking_
+#define _ranking_
+
+#include <stddef.h>
+
+/**
+ * Type: ranking
+ * -------------
+ * How a word's count in an article becomes that article's score for the
+ * word.  kRankByCount scores the raw count, as the index always has.
+ * kRankByBM25 uses Okapi BM25,
+ *
+ *     idf * (k1 + 1) * count / (count + k1 * (1 - b + b * length / avgLength))
+ *
+ * with k1 = 1.2 and b = 0.75, so that a word repeated in a short article
+ * counts for more than the same word in a long one, and rare words count
+ * for more than common ones.  Everything but the count is per word (the
+ * weight) or per article (the length norm), and both are computed ahead of
+ * time, leaving one multiply, one add and one divide per posting.
+ */
+
+typedef enum { kRankByCount, kRankByBM25 } rankingmode;
+
+typedef struct {
+    rankingmode mode;
+    const float *lengthNorms;    /* by article_id: k1 * (1 - b + b * length / avgLength) */
+    float minLengthNorm;
+    int numArticles;
+} ranking;
+
+/* The length norm of an article length words long */
+float RankingLengthNorm(int length, double avgLength);
+
+/* Per-word factor of every score, given how many articles contain it */
+double RankingWeight(const ranking *rk, int docFrequency);
+
+/* A score no article can beat where the word occurs at most maxCount times.
+ * The BM25 bound is nudged up so rounding can never make it too low. */
+double RankingBound(const ranking *rk, double weight, int maxCount);
+
+static inline double RankingScore(const ranking *rk, double weight, int count,
+                                  int article_id) {
+    if (rk->mode == kRankByCount) return count;
+    return weight * count / (count + rk->lengthNorms[article_id]);
+}
+
+#endif
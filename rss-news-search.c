@@ -3,6 +3,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
 
 #include <curl/curl.h>
 
@@ -11,23 +14,45 @@
 #include "streamtokenizer.h"
 #include "url.h"
 #include "index.h"
+#include "threadpool.h"
+#include "fetcher.h"
+#include "memtokenizer.h"
+#include "termcounts.h"
+#include "query.h"
+#include "feedcache.h"
+#include "rssparser.h"
+#include "queryserver.h"
 
 static void Welcome(const char *welcomeTextFileName);
+static char *ReadWholeFile(const char *fileName, size_t *length);
 static void BuildIndices(const char *feedsFileName);
+static void *Ingest(void *feedsFileName);
 static void ProcessFeed(const char *remoteDocumentName);
-static void PullAllNewsItems(FILE *dataStream);
-static bool GetNextItemTag(streamtokenizer *st);
-static void ProcessSingleNewsItem(streamtokenizer *st);
-static void ExtractElement(streamtokenizer *st, const char *htmlTag,
-                           char dataBuffer[], int bufferLength);
+static void FeedChunkArrived(const char *url, const char *bytes, size_t length,
+                             void *aux);
+static void FeedFetched(const char *url, char *body, size_t length, void *aux);
+static void FeedUnchanged(const char *url, void *aux);
+static void NewsItemParsed(const rssitem *item, void *aux);
+static void ProcessFeedFromFileTask(void *aux);
+static void ProcessNewsItem(const char *articleTitle,
+                            const char *articleDescription,
+                            const char *articleURL, void *feed);
+static void ArticleFetched(const char *url, char *body, size_t length,
+                           void *aux);
 static void ParseArticle(const char *articleTitle,
                          const char *articleDescription,
-                         const char *articleURL);
-static void ScanArticle(streamtokenizer *st, const char *articleTitle,
+                         const char *articleURL, char *articleDoc,
+                         size_t articleLength);
+static void ParseArticleTask(void *aux);
+static void ScanArticle(memtokenizer *mt, const char *articleTitle,
                         const char *unused, const char *articleURL);
 static void QueryIndices();
+static void ServeQueries();
+static void BatchQueries();
 static void ProcessResponse(const char *word);
-static bool WordIsWellFormed(const char *word);
+static void ProcessQuery(const char *text);
+static const char *ScoreNote(const result_t *r, char buffer[], size_t size);
+static bool WordIsWellFormed(const char *word, size_t length);
 
 /**
  * Function: main
@@ -51,75 +76,187 @@ static const char *const kDefaultFeedsFile = "data/test.txt";
 static const char *const kFilePrefix = "file://";
 static const char *const kTextDelimiters =
     " \t\n\r\b!@$%^*()_+={[}]|\\'\":;/?.>,<~";
+static delimiterset gArticleDelimiters; // kTextDelimiters, but "<" is returned
+static delimiterset gFileDelimiters;    // kTextDelimiters, all discarded
 static const char *const stopWordsFile = "data/stop-words.txt";
 static const int SIZE = 10007;
 static index_t *gIndex = NULL;
 
+/* Ingestion is a pipeline: gFetcher downloads every feed and article from a
+ * single event-driven thread, parsing feeds as they stream in and submitting
+ * each news item back to itself as soon as it's complete, feed workers index
+ * local file:// feeds, and article workers tokenize finished articles.  Every
+ * article worker tokenizes privately and then merges its tokens into gIndex
+ * with IndexAddArticle, which any number of workers can run at once.
+ * Downloads from any one server are capped at gNumTransfersPerHost at a
+ * time, so as not to get throttled or banned by publishers. */
+static const int kDefaultFeedWorkers = 4;
+static const int kDefaultArticleWorkers = 16;
+static const int kDefaultTransfers = 256;
+static const int kDefaultTransfersPerHost = 6;
+static int gNumFeedWorkers;
+static int gNumArticleWorkers;
+static int gNumTransfers;
+static int gNumTransfersPerHost;
+static threadpool *gFeedPool = NULL;
+static threadpool *gArticlePool = NULL;
+static fetcher *gFetcher = NULL;
+
+/* Results are ranked by raw word counts unless -r bm25 is given */
+static rankingmode gRanking = kRankByCount;
+
+/* -l answers queries from an index saved by an earlier run's -s instead of
+ * crawling the feeds again, and -u loads one, adds whatever the feeds have
+ * published since, and saves it back */
+static const char *gLoadFile = NULL;
+static const char *gSaveFile = NULL;
+static const char *gUpdateFile = NULL;
+
+/* -q starts taking queries right away, while the feeds are still being
+ * crawled on another thread, instead of once everything is indexed.  Each
+ * query sees the articles indexed by the time it's asked */
+static bool gQueryWhileIndexing = false;
+
+/* -S answers queries from other programs, over a socket listening on the
+ * given address (see queryserver.h), in place of the prompt.  The socket
+ * is opened before anything else, so a bad address is caught right away */
+static const char *gServeAddress = NULL;
+static int gListener = -1;
+
+/* -b runs every query in the given file (one per line, blank lines
+ * skipped) instead of prompting, spread over a thread per processor, and
+ * writes their answers, in the server's JSON, to the file's name plus
+ * ".jsonl", in the file's order.  The batch runs once the crawl is over,
+ * so it can't be combined with -q, but the file is read before the crawl
+ * starts, so that a bad one is caught right away */
+static const char *gBatchFile = NULL;
+static char *gBatchQueries = NULL;
+
+/* News items not fetched because their articles are already indexed;
+ * fetcher thread only, until FetcherWait */
+static int gNumSeenItems = 0;
+
+/* Runs that save an index also save the validators of every feed they
+ * downloaded beside it (in index-file.feeds), and -u polls each feed
+ * conditionally on them, so feeds that haven't changed since the index was
+ * saved aren't downloaded or parsed again.  A feed with an article that
+ * couldn't be downloaded is forgotten instead, so that the next poll gets
+ * it whole and tries the article again */
+static feedcache gFeedCache;
+static bool gUseFeedCache = false;
+static char *gFeedCacheFile = NULL;
+static int gNumUnchangedFeeds = 0; // fetcher thread only, until FetcherWait
+
+static void Usage(const char *program) {
+  fprintf(stderr, "Usage: %s [-f feed-workers] [-a article-workers] "
+                  "[-c concurrent-transfers] [-p transfers-per-server] [-r count|bm25] "
+                  "[-l index-file | -s index-file | -u index-file] [-q] [-S address | -b queries-file] [feeds-file]\n",
+          program);
+  exit(1);
+}
+
 int main(int argc, char **argv) {
+  gNumFeedWorkers = kDefaultFeedWorkers;
+  gNumArticleWorkers = kDefaultArticleWorkers;
+  gNumTransfers = kDefaultTransfers;
+  gNumTransfersPerHost = kDefaultTransfersPerHost;
+  int opt;
+  while ((opt = getopt(argc, argv, "f:a:c:p:r:l:s:u:qS:b:")) != -1) {
+    switch (opt) {
+    case 'f': gNumFeedWorkers = atoi(optarg); break;
+    case 'a': gNumArticleWorkers = atoi(optarg); break;
+    case 'c': gNumTransfers = atoi(optarg); break;
+    case 'p': gNumTransfersPerHost = atoi(optarg); break;
+    case 'r':
+      if (strcmp(optarg, "bm25") == 0) gRanking = kRankByBM25;
+      else if (strcmp(optarg, "count") == 0) gRanking = kRankByCount;
+      else Usage(argv[0]);
+      break;
+    case 'l': gLoadFile = optarg; break;
+    case 's': gSaveFile = optarg; break;
+    case 'u': gUpdateFile = optarg; break;
+    case 'q': gQueryWhileIndexing = true; break;
+    case 'S': gServeAddress = optarg; break;
+    case 'b': gBatchFile = optarg; break;
+    default: Usage(argv[0]);
+    }
+  }
+  int numIndexFiles = (gLoadFile != NULL) + (gSaveFile != NULL) + (gUpdateFile != NULL);
+  if (gNumFeedWorkers <= 0 || gNumArticleWorkers <= 0 || gNumTransfers <= 0 ||
+      gNumTransfersPerHost <= 0 || argc - optind > 1 || numIndexFiles > 1 ||
+      (gBatchFile != NULL && (gServeAddress != NULL || gQueryWhileIndexing)))
+    Usage(argv[0]);
+  if (gBatchFile != NULL) {
+    size_t length;
+    gBatchQueries = ReadWholeFile(gBatchFile, &length);
+    if (gBatchQueries == NULL) {
+      fprintf(stderr, "Couldn't read queries from \"%s\".\n", gBatchFile);
+      exit(1);
+    }
+  }
+  if (gUpdateFile != NULL) {
+    // the first update has nothing to load, but later ones must never
+    // replace an index they couldn't read
+    if (access(gUpdateFile, F_OK) == 0) gLoadFile = gUpdateFile;
+    gSaveFile = gUpdateFile;
+  }
+  if (gSaveFile != NULL) {
+    gFeedCacheFile = malloc(strlen(gSaveFile) + strlen(".feeds") + 1);
+    assert(gFeedCacheFile != NULL);
+    sprintf(gFeedCacheFile, "%s.feeds", gSaveFile);
+    FeedCacheNew(&gFeedCache);
+    gUseFeedCache = true;
+    if (gLoadFile != NULL) // validators are only good for the index they came with
+      FeedCacheLoad(&gFeedCache, gFeedCacheFile);
+  }
+  if (gServeAddress != NULL) {
+    gListener = QueryServerListen(gServeAddress);
+    if (gListener < 0) exit(1);
+  }
+
   setbuf(stdout, NULL);
   curl_global_init(CURL_GLOBAL_DEFAULT);
+  DSNew(&gArticleDelimiters, kTextDelimiters, "<");
+  DSNew(&gFileDelimiters, kTextDelimiters, "");
   Welcome(kWelcomeTextFile);
   
-  gIndex = IndexCreate(SIZE);
+  if (gLoadFile != NULL) {
+    gIndex = IndexLoad(gLoadFile);
+    if (gIndex == NULL) {
+      fprintf(stderr, "Couldn't load an index from \"%s\".\n", gLoadFile);
+      exit(1);
+    }
+  } else {
+    gIndex = IndexCreate(SIZE);
+  }
+  IndexSetRanking(gIndex, gRanking);
   IndexLoadStopWords(gIndex, stopWordsFile);
-  BuildIndices((argc == 1) ? kDefaultFeedsFile : argv[1]);
-  QueryIndices();
+  const char *feedsFileName = (optind == argc) ? kDefaultFeedsFile : argv[optind];
+  void (*answerQueries)(void) = (gListener >= 0) ? ServeQueries
+                                : (gBatchFile != NULL) ? BatchQueries : QueryIndices;
+  if (gLoadFile != NULL && gUpdateFile == NULL) {
+    answerQueries();
+  } else if (gQueryWhileIndexing) {
+    pthread_t ingester;
+    if (pthread_create(&ingester, NULL, Ingest, (void *)feedsFileName) == 0) {
+      answerQueries();
+      pthread_join(ingester, NULL);
+    } else { // no thread to crawl on: crawl first, as without -q
+      fprintf(stderr, "Couldn't start crawling in the background; "
+                      "queries will wait for it.\n");
+      Ingest((void *)feedsFileName);
+      answerQueries();
+    }
+  } else {
+    Ingest((void *)feedsFileName);
+    answerQueries();
+  }
   IndexDestroy(gIndex);
   
   curl_global_cleanup();
   return 0;
 }
 
-size_t SavePage(char *ptr, size_t size, size_t nmemb, void *data) {
-  return fprintf((FILE *)data, "%s", ptr);
-}
-
-static FILE *RemoveCData(const char *tmpFile) {
-  FILE *inp = fopen(tmpFile, "rb");
-  fseek(inp, 0, SEEK_END);
-  long fsize = ftell(inp);
-  fseek(inp, 0, SEEK_SET); /* same as rewind(f); */
-  char *contents = malloc(fsize + 1);
-  long read = fread(contents, 1, fsize, inp);
-  assert(fsize == read);
-  fclose(inp);
-  FILE *out = fopen(tmpFile, "w");
-  bool inside_cdata = false;
-  for (int i = 0; i < fsize; ++i) {
-    if (strncasecmp(contents + i, "<![CDATA[", strlen("<![CDATA[")) == 0) {
-      inside_cdata = true;
-      i += strlen("<![CDATA[") - 1;
-    } else if (inside_cdata && strncmp(contents + i, "]]>", 3) == 0) {
-      inside_cdata = false;
-      i += 2;
-    } else {
-      fprintf(out, "%c", contents[i]);
-    }
-  }
-  fclose(out);
-  free(contents);
-  return fopen(tmpFile, "r");
-}
-
-static FILE *FetchURL(const char *path, const char *tmpFile) {
-  FILE *tmpDoc = fopen(tmpFile, "w");
-  CURL *curl;
-  CURLcode res;
-  curl = curl_easy_init();
-  curl_easy_setopt(curl, CURLOPT_VERBOSE, 0L);
-  curl_easy_setopt(curl, CURLOPT_URL, path);
-  curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, SavePage);
-  curl_easy_setopt(curl, CURLOPT_WRITEDATA, tmpDoc);
-  res = curl_easy_perform(curl);
-  fclose(tmpDoc);
-  curl_easy_cleanup(curl);
-  if (res != CURLE_OK) {
-    return NULL;
-  }
-  return RemoveCData(tmpFile);
-}
-
 /**
  * Function: Welcome
  * -----------------
@@ -165,7 +302,13 @@ static void Welcome(const char *welcomeTextFileName) {
  * Each iteration of the supplied while loop parses and discards the feed name
  * (it's in the file for humans to read, but our aggregator doesn't care what
  * the name is) and then extracts the URL.  It then relies on ProcessFeed to
- * pull the remote document and index its content.
+ * start pulling the remote document.  Everything downstream is asynchronous:
+ * feeds are parsed on the fetcher thread as they arrive, each news item is
+ * submitted back to the fetcher, local feeds are indexed on the feed pool,
+ * and finished articles are indexed on the article pool.  Work only ever
+ * flows forward through that pipeline (the fetcher counts the articles a
+ * feed submits before the feed itself finishes), so draining each stage in
+ * order (fetcher, feed pool, article pool) drains all of it.
  */
 
 static void BuildIndices(const char *feedsFileName) {
@@ -175,6 +318,13 @@ static void BuildIndices(const char *feedsFileName) {
 
   infile = fopen(feedsFileName, "r");
   assert(infile != NULL);
+  // the fetcher thread checks every news item for duplicates, and mustn't
+  // be held up refilling the duplicate checks of a loaded index
+  IndexPrepareDuplicateChecks(gIndex);
+  gFetcher = FetcherNew(gNumTransfers, gNumTransfersPerHost);
+  assert(gFetcher != NULL);
+  gFeedPool = ThreadPoolNew(gNumFeedWorkers);
+  gArticlePool = ThreadPoolNew(gNumArticleWorkers);
   STNew(&st, infile, kNewLineDelimiters, true);
   while (STSkipUntil(&st, ":") !=
          EOF) { // ignore everything up to the first selicolon of the line
@@ -187,222 +337,256 @@ static void BuildIndices(const char *feedsFileName) {
 
   STDispose(&st);
   fclose(infile);
+
+  FetcherWait(gFetcher); // every feed is parsed, every article queued for indexing
+  ThreadPoolWait(gFeedPool);
+  ThreadPoolWait(gArticlePool);
+  FetcherDispose(gFetcher);
+  ThreadPoolDispose(gFeedPool);
+  ThreadPoolDispose(gArticlePool);
+  gFetcher = NULL;
+  gFeedPool = gArticlePool = NULL;
+  if (gNumUnchangedFeeds > 0)
+    printf("%d feed%s unchanged since the last poll.\n", gNumUnchangedFeeds,
+           (gNumUnchangedFeeds == 1) ? "" : "s");
+  if (gNumSeenItems > 0)
+    printf("Skipped %d news item%s whose articles were already indexed.\n",
+           gNumSeenItems, (gNumSeenItems == 1) ? "" : "s");
   printf("\n");
 }
 
+/**
+ * Function: Ingest
+ * ----------------
+ * Crawls the feeds into gIndex and then saves it, if a save was asked for.
+ * Runs on a thread of its own under -q; queries can go on meanwhile, since
+ * gIndex answers them without waiting on the crawl, but saving waits until
+ * the crawl is over.
+ */
+
+static void *Ingest(void *feedsFileName) {
+  BuildIndices(feedsFileName);
+  if (gSaveFile != NULL) {
+    if (!IndexSave(gIndex, gSaveFile))
+      fprintf(stderr, "Couldn't save the index to \"%s\".\n", gSaveFile);
+    else if (!FeedCacheSave(&gFeedCache, gFeedCacheFile))
+      fprintf(stderr, "Couldn't save feed validators to \"%s\".\n", gFeedCacheFile);
+    FeedCacheDispose(&gFeedCache);
+    free(gFeedCacheFile);
+  }
+  return NULL;
+}
+
+/**
+ * Function: ReadWholeFile
+ * -----------------------
+ * Reads the named file into a malloc'd, '\0'-terminated buffer, which the
+ * caller owns, and sets *length to its size (the '\0' aside).  Returns
+ * NULL if the file can't be opened or read.
+ */
+
+static char *ReadWholeFile(const char *fileName, size_t *length) {
+  FILE *infile = fopen(fileName, "rb");
+  if (infile == NULL) return NULL;
+  // read until end of file rather than asking for the size up front, which
+  // pipes and terminals don't have
+  size_t allocated = 4096, used = 0, n;
+  char *contents = malloc(allocated);
+  assert(contents != NULL);
+  while ((n = fread(contents + used, 1, allocated - used - 1, infile)) > 0) {
+    used += n;
+    if (used + 1 == allocated) {
+      allocated *= 2;
+      contents = realloc(contents, allocated);
+      assert(contents != NULL);
+    }
+  }
+  bool failed = ferror(infile);
+  fclose(infile);
+  if (failed) {
+    free(contents);
+    return NULL;
+  }
+  contents[used] = '\0';
+  *length = used;
+  return contents;
+}
+
 /** * Function: ProcessFeedFromFile * --------------------- * ProcessFeed
  * locates the specified RSS document, from locally */
 
 static void ProcessFeedFromFile(char *fileName) {
-  FILE *infile;
-  streamtokenizer st;
+  memtokenizer mt;
   char articleDescription[1024];
   articleDescription[0] = '\0';
-  infile = fopen((const char *)fileName, "r");
-  assert(infile != NULL);
-  STNew(&st, infile, kTextDelimiters, true);
-  ScanArticle(&st, (const char *)fileName, articleDescription,
+  size_t length;
+  char *contents = ReadWholeFile(fileName, &length);
+  if (contents == NULL) {
+    printf("Unable to read file: %s\n", fileName);
+    return;
+  }
+  MTNew(&mt, contents, length, &gFileDelimiters);
+  ScanArticle(&mt, (const char *)fileName, articleDescription,
               (const char *)fileName);
-  STDispose(&st); // remember that STDispose doesn't close the file, since STNew
-                  // doesn't open one..
-  fclose(infile);
+  free(contents);
+}
+
+static void ProcessFeedFromFileTask(void *aux) {
+  char *fileName = aux;
+  ProcessFeedFromFile(fileName);
+  free(fileName);
 }
 
+/* A remote feed being polled, and how many downloads (its own, then those
+ * of its articles) are still to finish; fetcher thread only */
+typedef struct {
+  rssparser parser;
+  char *url;
+  int pending;
+  bool incomplete;        // some article couldn't be downloaded
+} feedJob;
+
 /**
  * Function: ProcessFeed
  * ---------------------
- * ProcessFeed locates the specified RSS document, and if a (possibly
- * redirected) connection to that remote document can be established, then
- * PullAllNewsItems is tapped to actually read the feed.  Check out the
- * documentation of the PullAllNewsItems function for more information, and
- * inspect the documentation for ParseArticle for information about what the
- * different response codes mean.
+ * ProcessFeed locates the specified RSS document, and submits it to the
+ * fetcher as a streaming request: each piece of the feed is handed to an
+ * rssparser as it comes off the network, on the fetcher thread, and each
+ * news item goes to ProcessNewsItem the moment its </item> arrives, so the
+ * first articles are downloading while the rest of the feed is still on its
+ * way.  Inspect the documentation for ParseArticle for information about
+ * what the different response codes mean.  Local file:// documents skip
+ * the fetcher.
  */
 
 static void ProcessFeed(const char *remoteDocumentName) {
 
   if (!strncmp(kFilePrefix, remoteDocumentName, strlen(kFilePrefix))) {
-    ProcessFeedFromFile((char *)remoteDocumentName + strlen(kFilePrefix));
+    ThreadPoolSchedule(gFeedPool, ProcessFeedFromFileTask,
+                       strdup(remoteDocumentName + strlen(kFilePrefix)));
     return;
   }
 
-  FILE *tmpFeed = FetchURL(remoteDocumentName, "tmp_feed");
-  PullAllNewsItems(tmpFeed);
-  fclose(tmpFeed);
+  feedJob *feed = malloc(sizeof(feedJob));
+  assert(feed != NULL);
+  RSSParserNew(&feed->parser, NewsItemParsed, feed);
+  feed->url = strdup(remoteDocumentName);
+  feed->pending = 1;
+  feed->incomplete = false;
+  FetcherSubmitStreaming(gFetcher, remoteDocumentName,
+                         gUseFeedCache ? &gFeedCache : NULL, FeedChunkArrived,
+                         FeedFetched, FeedUnchanged, feed);
 }
 
 /**
- * Function: PullAllNewsItems
- * --------------------------
- * Steps though the data of what is assumed to be an RSS feed identifying the
- * names and URLs of online news articles.  Check out
- * "datafiles/sample-rss-feed.txt" for an idea of what an RSS feed from the
- * www.nytimes.com (or anything other server that syndicates is stories).
- *
- * PullAllNewsItems views a typical RSS feed as a sequence of "items", where
- * each item is detailed using a generalization of HTML called XML.  A typical
- * XML fragment for a single news item will certainly adhere to the format of
- * the following example:
- *
- * <item>
- *   <title>At Installation Mass, New Pope Strikes a Tone of Openness</title>
- *   <link>http://www.nytimes.com/2005/04/24/international/worldspecial2/24cnd-pope.html</link>
- *   <description>The Mass, which drew 350,000 spectators, marked an important
- * moment in the transformation of Benedict XVI.</description> <author>By IAN
- * FISHER and LAURIE GOODSTEIN</author> <pubDate>Sun, 24 Apr 2005 00:00:00
- * EDT</pubDate> <guid
- * isPermaLink="false">http://www.nytimes.com/2005/04/24/international/worldspecial2/24cnd-pope.html</guid>
- * </item>
- *
- * PullAllNewsItems reads and discards all characters up through the opening
- * <item> tag (discarding the <item> tag as well, because once it's read and
- * indentified, it's been pulled,) and then hands the state of the stream to
- * ProcessSingleNewsItem, which handles the job of pulling and analyzing
- * everything up through and including the </item> tag. PullAllNewsItems
- * processes the entire RSS feed and repeatedly advancing to the next <item> tag
- * and then allowing ProcessSingleNewsItem do process everything up until
- * </item>.
+ * Function: ReleaseFeed
+ * ---------------------
+ * Called on the fetcher thread once the feed's own download, or one of the
+ * article downloads it led to, is over.  The last one frees the feed, and
+ * first forgets its validators if any article couldn't be downloaded: the
+ * fetcher recorded them as soon as the feed came in, and keeping them
+ * would get the next poll a 304 for the feed, so the article would never
+ * be tried again.  The order the downloads finish in doesn't matter,
+ * since the fetcher records validators before FeedFetched runs.
  */
 
-static void PullAllNewsItems(FILE *dataStream) {
-  streamtokenizer st;
-  STNew(&st, dataStream, kTextDelimiters, false);
-  while (GetNextItemTag(
-      &st)) { // if true is returned, then assume that <item ...> has just been
-              // read and pulled from the data stream
-    ProcessSingleNewsItem(&st);
-  }
+static void ReleaseFeed(feedJob *feed) {
+  if (--feed->pending > 0) return;
+  if (gUseFeedCache && feed->incomplete)
+    FeedCacheStore(&gFeedCache, feed->url, NULL, NULL);
+  free(feed->url);
+  free(feed);
+}
 
-  STDispose(&st);
+static void FeedChunkArrived(const char *url, const char *bytes, size_t length,
+                             void *aux) {
+  feedJob *feed = aux;
+  RSSParserFeed(&feed->parser, bytes, length);
 }
 
-/**
- * Function: GetNextItemTag
- * ------------------------
- * Works more or less like GetNextTag below, but this time
- * we're searching for an <item> tag, since that marks the
- * beginning of a block of HTML that's relevant to us.
- *
- * Note that each tag is compared to "<item" and not "<item>".
- * That's because the item tag, though unlikely, could include
- * attributes and perhaps look like any one of these:
- *
- *   <item>
- *   <item rdf:about="Latin America reacts to the Vatican">
- *   <item requiresPassword=true>
- *
- * We're just trying to be as general as possible without
- * going overboard.  (Note that we use strncasecmp so that
- * string comparisons are case-insensitive.  That's the case
- * throughout the entire code base.)
- */
+static void FeedFetched(const char *url, char *body, size_t length, void *aux) {
+  if (body == NULL) // items parsed before the failure are still indexed
+    printf("Unable to fetch URL: %s\n", url);
+  free(body);
+  ReleaseFeed(aux);
+}
 
-static const char *const kItemTagPrefix = "<item";
-static bool GetNextItemTag(streamtokenizer *st) {
-  char htmlTag[1024];
-  while (GetNextTag(st, htmlTag, sizeof(htmlTag))) {
-    if (strncasecmp(htmlTag, kItemTagPrefix, strlen(kItemTagPrefix)) == 0) {
-      return true;
-    }
-  }
-  return false;
+static void FeedUnchanged(const char *url, void *aux) {
+  gNumUnchangedFeeds++; // every item was indexed when the feed last changed
+  ReleaseFeed(aux);
+}
+
+static void NewsItemParsed(const rssitem *item, void *aux) {
+  ProcessNewsItem(item->title, item->description, item->link, aux);
 }
 
 /**
- * Function: ProcessSingleNewsItem
- * -------------------------------
- * Code which parses the contents of a single <item> node within an RSS/XML
- * feed. At the moment this function is called, we're to assume that the <item>
- * tag was just read and that the streamtokenizer is currently pointing to
- * everything else, as with:
+ * Function: ProcessNewsItem
+ * -------------------------
+ * Handles a single <item> node of an RSS/XML feed, as in:
  *
- *      <title>Carrie Underwood takes American Idol Crown</title>
- *      <description>Oklahoma farm girl beats out Alabama rocker Bo Bice and
- * 100,000 other contestants to win competition.</description>
- *      <link>http://www.nytimes.com/frontpagenews/2841028302.html</link>
+ *   <item>
+ *     <title>Carrie Underwood takes American Idol Crown</title>
+ *     <description>Oklahoma farm girl beats out Alabama rocker Bo Bice and
+ *       100,000 other contestants to win competition.</description>
+ *     <link>http://www.nytimes.com/frontpagenews/2841028302.html</link>
  *   </item>
  *
- * ProcessSingleNewsItem parses everything up through and including the </item>,
- * storing the title, link, and article description in local buffers long enough
- * so that the online new article identified by the link can itself be parsed
- * and indexed.  We don't rely on <title>, <link>, and <description> coming in
- * any particular order.  We do asssume that the link field exists (although we
- * can certainly proceed if the title and article descrption are missing.) There
- * are often other tags inside an item, but we ignore them.
+ * The rssparser has already pulled out the title, description and link, in
+ * whatever order they came, and ignored the item's other tags.  The online
+ * news article identified by the link is submitted to the fetcher, along
+ * with copies of all three strings for ParseArticle to use once the
+ * download completes.  We do assume that the link exists (although we can
+ * certainly proceed if the title and article description are missing.)
+ * Items whose articles are already indexed (typically because -u loaded
+ * them from an earlier poll) are dropped without being downloaded.  feed
+ * is the feedJob the item came from, which stays around until the
+ * article's download is over.
  */
 
-static const char *const kItemEndTag = "</item>";
-static const char *const kTitleTagPrefix = "<title";
-static const char *const kDescriptionTagPrefix = "<description";
-static const char *const kLinkTagPrefix = "<link";
-static void ProcessSingleNewsItem(streamtokenizer *st) {
-  char htmlTag[1024];
-  char articleTitle[1024];
-  char articleDescription[1024];
-  char articleURL[1024];
-  articleTitle[0] = articleDescription[0] = articleURL[0] = '\0';
-
-  while (GetNextTag(st, htmlTag, sizeof(htmlTag)) &&
-         (strcasecmp(htmlTag, kItemEndTag) != 0)) {
-    if (strncasecmp(htmlTag, kTitleTagPrefix, strlen(kTitleTagPrefix)) == 0) {
-      ExtractElement(st, htmlTag, articleTitle, sizeof(articleTitle));
-    }
-    if (strncasecmp(htmlTag, kDescriptionTagPrefix,
-                    strlen(kDescriptionTagPrefix)) == 0)
-      ExtractElement(st, htmlTag, articleDescription,
-                     sizeof(articleDescription));
-    if (strncasecmp(htmlTag, kLinkTagPrefix, strlen(kLinkTagPrefix)) == 0)
-      ExtractElement(st, htmlTag, articleURL, sizeof(articleURL));
-  }
-
-  if (strncmp(articleURL, "", sizeof(articleURL)) == 0)
+typedef struct {
+  char *title;
+  char *description;
+  char *url;
+  char *doc;
+  size_t docLength;
+  feedJob *feed;
+} articleJob;
+
+static void ProcessNewsItem(const char *articleTitle,
+                            const char *articleDescription,
+                            const char *articleURL, void *feed) {
+  if (articleURL[0] == '\0')
     return; // punt, since it's not going to take us anywhere
-  ParseArticle(articleTitle, articleDescription, articleURL);
-}
 
-/**
- * Function: ExtractElement
- * ------------------------
- * Potentially pulls text from the stream up through and including the matching
- * end tag.  It assumes that the most recently extracted HTML tag resides in the
- * buffer addressed by htmlTag.  The implementation populates the specified data
- * buffer with all of the text up to but not including the opening '<' of the
- * closing tag, and then skips over all of the closing tag as irrelevant.
- * Assuming for illustration purposes that htmlTag addresses a buffer containing
- * "<description" followed by other text, these three scanarios are handled:
- *
- *    Normal Situation:
- * <description>http://some.server.com/someRelativePath.html</description>
- *    Uncommon Situation:   <description></description>
- *    Uncommon Situation:   <description/>
- *
- * In each of the second and third scenarios, the document has omitted the data.
- * This is not uncommon for the description data to be missing, so we need to
- * cover all three scenarious (I've actually seen all three.) It would be quite
- * unusual for the title and/or link fields to be empty, but this handles those
- * possibilities too.
- */
+  // most items of a re-polled feed were indexed last time around, and the
+  // index would only turn them down again after downloading them
+  if (IndexContainsArticle(gIndex, articleURL, articleTitle)) {
+    gNumSeenItems++;
+    return;
+  }
 
-static void ExtractElement(streamtokenizer *st, const char *htmlTag,
-                           char dataBuffer[], int bufferLength) {
-  assert(htmlTag[strlen(htmlTag) - 1] == '>');
-  if (htmlTag[strlen(htmlTag) - 2] == '/')
-    return; // e.g. <description/> would state that a description is not being
-            // supplied
-  STNextTokenUsingDifferentDelimiters(st, dataBuffer, bufferLength, "<");
-  RemoveEscapeCharacters(dataBuffer);
-  if (dataBuffer[0] == '<')
-    strcpy(dataBuffer, ""); // e.g. <description></description> also means
-                            // there's no description
-  STSkipUntil(st, ">");
-  STSkipOver(st, ">");
+  articleJob *job = malloc(sizeof(articleJob));
+  assert(job != NULL);
+  job->title = strdup(articleTitle);
+  job->description = strdup(articleDescription);
+  job->url = strdup(articleURL);
+  job->doc = NULL;
+  job->docLength = 0;
+  job->feed = feed;
+  job->feed->pending++;
+  FetcherSubmit(gFetcher, articleURL, ArticleFetched, job);
 }
 
 /**
  * Function: ParseArticle
  * ----------------------
- * Attempts to establish a network connect to the news article identified by the
- * three parameters.  The network connection is either established of not.  The
+ * Indexes the news article identified by the three parameters, given the
+ * document the fetcher downloaded for it (which ParseArticle modifies in
+ * place, but the caller still owns).  The document is tokenized in a single
+ * pass; CDATA sections are unwrapped by the memtokenizer as it goes.
+ * The network connection behind that download was either established or not
+ * (failures never reach ParseArticle; ArticleFetched reports them).  The
  * implementation is prepared to handle a subset of possible (but by far the
  * most common) scenarios, and those scenarios are categorized by response code:
  *
@@ -421,18 +605,45 @@ static void ExtractElement(streamtokenizer *st, const char *htmlTag,
 
 static void ParseArticle(const char *articleTitle,
                          const char *articleDescription,
-                         const char *articleURL) {
-  FILE *tmpDoc = FetchURL(articleURL, "tmp_doc");
-  if (tmpDoc == NULL) {
-    printf("Unable to fetch URL: %s\n", articleURL);
+                         const char *articleURL, char *articleDoc,
+                         size_t articleLength) {
+  printf("Scanning \"%s\"\n", articleTitle);
+  memtokenizer mt;
+  MTNew(&mt, articleDoc, articleLength, &gArticleDelimiters);
+  ScanArticle(&mt, articleTitle, articleDescription, articleURL);
+}
+
+static void FreeArticleJob(articleJob *job) {
+  free(job->title);
+  free(job->description);
+  free(job->url);
+  free(job->doc);
+  free(job);
+}
+
+static void ArticleFetched(const char *url, char *body, size_t length,
+                           void *aux) {
+  articleJob *job = aux;
+  if (body == NULL) {
+    printf("Unable to fetch URL: %s\n", url);
+    job->feed->incomplete = true;
+  }
+  ReleaseFeed(job->feed); // the article pool mustn't touch it
+  job->feed = NULL;
+  if (body == NULL) {
+    FreeArticleJob(job);
     return;
   }
-  printf("Scanning \"%s\"\n", articleTitle);
-  streamtokenizer st;
-  STNew(&st, tmpDoc, kTextDelimiters, false);
-  ScanArticle(&st, articleTitle, articleDescription, articleURL);
-  STDispose(&st);
-  fclose(tmpDoc);
+  job->doc = body;
+  job->docLength = length;
+  ThreadPoolSchedule(gArticlePool, ParseArticleTask, job);
+}
+
+static void ParseArticleTask(void *aux) {
+  articleJob *job = aux;
+  ParseArticle(job->title, job->description, job->url, job->doc,
+               job->docLength);
+  FreeArticleJob(job);
 }
 
 /**
@@ -444,49 +655,77 @@ static void ParseArticle(const char *articleTitle,
  * words is printed, and the longest well-formed word we encountered along the
  * way is printed as well.
  *
- * This is really a placeholder implementation for what will ultimately be
- * code that indexes the specified content.
+ * Tokenizing happens without any locks: the well-formed words are counted in
+ * a private termcounts table, which IndexAddArticle then merges into gIndex
+ * alongside whatever other workers are merging.
  */
 
-static void ScanArticle(streamtokenizer *st, const char *articleTitle,
+static const size_t kMaxWordLength = 1023;
+
+/**
+ * Function: RemoveEscapeCharactersInPlace
+ * ---------------------------------------
+ * Decodes any HTML escape sequences inside word, overwriting the text it
+ * refers to and shrinking its length to match.  Words are slices of the
+ * article buffer we own, and decoding never lengthens a word, so this is
+ * safe.  Words without an '&' (nearly all of them) are left untouched.
+ */
+
+static void RemoveEscapeCharactersInPlace(slice *word) {
+  if (memchr(word->start, '&', word->length) == NULL) return;
+  char decoded[kMaxWordLength + 1];
+  memcpy(decoded, word->start, word->length);
+  decoded[word->length] = '\0';
+  RemoveEscapeCharacters(decoded);
+  word->length = strlen(decoded);
+  memcpy((char *)word->start, decoded, word->length);
+}
+
+static void ScanArticle(memtokenizer *mt, const char *articleTitle,
                         const char *unused, const char *articleURL) {
   int numWords = 0;
-  char word[1024];
-  char longestWord[1024] = {'\0'};
-
-  /* Register article in the index; IndexRegisterArticle returns article_id or -1 if duplicate/fail */
-  int article_id = IndexRegisterArticle(gIndex, articleURL, articleTitle);
-  if(article_id >= 0){
-    while (STNextToken(st, word, sizeof(word))) {
-      if (strcasecmp(word, "<") == 0) {
-        SkipIrrelevantContent(st); // in html-utls.h
-      } else {
-        RemoveEscapeCharacters(word);
-        if (WordIsWellFormed(word)) {
-          IndexAddToken(gIndex, article_id, word);
-          numWords++;
-          if (strlen(word) > strlen(longestWord))
-            strcpy(longestWord, word);
-        }
+  slice word;
+  slice longestWord = {"", 0};
+  termcounts terms;
+  TermCountsNew(&terms, 256);
+
+  while (MTNextToken(mt, &word)) {
+    if (word.length == 1 && word.start[0] == '<') {
+      MTSkipIrrelevantContent(mt); // memtokenizer's take on html-utils.h
+    } else {
+      if (word.length > kMaxWordLength) // cut short, as STNextToken did
+        word.length = kMaxWordLength;
+      RemoveEscapeCharactersInPlace(&word);
+      if (WordIsWellFormed(word.start, word.length)) {
+        TermCountsAdd(&terms, word.start, word.length);
+        numWords++;
+        if (word.length > longestWord.length)
+          longestWord = word;
       }
     }
-  } else {
-    /* Duplicate or failed to register: still need to consume tokens to advance stream */
-    while (STNextToken(st, word, sizeof(word))) {
-      if (strcasecmp(word, "<") == 0)
-        SkipIrrelevantContent(st);
-    }
+  }
+
+  /* Register article in the index; IndexAddArticle returns article_id or -1 if duplicate/fail */
+  int article_id = IndexAddArticle(gIndex, articleURL, articleTitle, &terms);
+  TermCountsDispose(&terms);
+
+  flockfile(stdout); // keep this article's report in one piece
+  if (article_id < 0) {
     /* Keep diagnostics simple for duplicates */
     printf("\t[skipped duplicate or unregistered article: \"%s\"]\n", articleTitle ? articleTitle : "(no title)");
+    funlockfile(stdout);
     return;
   }
 
   printf("\tWe counted %d well-formed words [including duplicates].\n",
          numWords);
-  printf("\tThe longest word scanned was \"%s\".", longestWord);
-  if (strlen(longestWord) >= 15 && (strchr(longestWord, '-') == NULL))
+  printf("\tThe longest word scanned was \"%.*s\".", (int)longestWord.length,
+         longestWord.start);
+  if (longestWord.length >= 15 &&
+      (memchr(longestWord.start, '-', longestWord.length) == NULL))
     printf(" [Ooooo... long word!]");
   printf("\n");
+  funlockfile(stdout);
 }
 
 /**
@@ -494,21 +733,139 @@ static void ScanArticle(streamtokenizer *st, const char *articleTitle,
  * ----------------------
  * Standard query loop that allows the user to specify a single search term, and
  * then proceeds (via ProcessResponse) to list up to 10 articles (sorted by
- * relevance) that contain that word.
+ * relevance) that contain that word.  Responses with several words or with
+ * AND, OR or NOT in them are handed to ProcessQuery instead.
  */
 
 static void QueryIndices() {
   char response[1024];
   while (true) {
-    printf("Please enter a single search term [enter to break]: ");
+    printf("Please enter a search term or query [enter to break]: ");
     fgets(response, sizeof(response), stdin);
     response[strlen(response) - 1] = '\0';
     if (strcasecmp(response, "") == 0)
       break;
-    ProcessResponse(response);
+    if (QueryIsCompound(response))
+      ProcessQuery(response);
+    else
+      ProcessResponse(response);
   }
 }
 
+/**
+ * Function: ServeQueries
+ * ----------------------
+ * Server counterpart of QueryIndices: answers queries from any number of
+ * clients of the -S socket, as JSON, until the process is killed.  Clients
+ * only ever see the articles indexed so far, so under -q the crawl can go
+ * on (and save the index when it's done) while they're being served.
+ */
+
+static void ServeQueries() {
+  printf("Answering queries on %s.\n", gServeAddress);
+  QueryServerRun(gIndex, gListener, 10);
+}
+
+/* One query of a -b batch, and what became of it */
+typedef struct {
+  const char *text;
+  char *answer;           // open_memstream'd
+  size_t length;
+  double seconds;
+} batchquery;
+
+/* Seconds since some fixed point in the past */
+static double Now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void BatchQueryTask(void *aux) {
+  batchquery *bq = aux;
+  double start = Now();
+  FILE *out = open_memstream(&bq->answer, &bq->length);
+  assert(out != NULL);
+  QueryServerAnswer(gIndex, bq->text, 10, out);
+  fclose(out);
+  bq->seconds = Now() - start;
+}
+
+static int CompareSeconds(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * Function: BatchQueries
+ * ----------------------
+ * Answers every query in gBatchQueries (gBatchFile's contents) on a pool with a worker per processor,
+ * each answer written to its own memory stream so that they can all be
+ * written out in order once the pool is done, and then reports the
+ * throughput and the median and 99th percentile latencies.  A query's
+ * latency runs from when a worker picks it up to when its answer is
+ * formatted, so it leaves out time spent waiting in the pool's queue.
+ */
+
+static void BatchQueries() {
+  int numQueries = 0, allocated = 64;
+  batchquery *queries = malloc(allocated * sizeof(batchquery));
+  assert(queries != NULL);
+  char *saveptr;
+  for (char *line = strtok_r(gBatchQueries, kNewLineDelimiters, &saveptr); line != NULL;
+       line = strtok_r(NULL, kNewLineDelimiters, &saveptr)) {
+    if (strspn(line, " \t") == strlen(line)) continue;
+    if (numQueries == allocated) {
+      allocated *= 2;
+      queries = realloc(queries, allocated * sizeof(batchquery));
+      assert(queries != NULL);
+    }
+    queries[numQueries++].text = line;
+  }
+
+  char *resultsFile = malloc(strlen(gBatchFile) + strlen(".jsonl") + 1);
+  assert(resultsFile != NULL);
+  sprintf(resultsFile, "%s.jsonl", gBatchFile);
+  FILE *out = fopen(resultsFile, "w");
+  if (out == NULL) {
+    fprintf(stderr, "Couldn't write results to \"%s\".\n", resultsFile);
+  } else {
+    long numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (numThreads <= 0) numThreads = 1;
+    double start = Now();
+    threadpool *pool = ThreadPoolNew((int)numThreads);
+    for (int i = 0; i < numQueries; i++)
+      ThreadPoolSchedule(pool, BatchQueryTask, &queries[i]);
+    ThreadPoolDispose(pool);
+    double elapsed = Now() - start;
+
+    double *seconds = malloc((numQueries + 1) * sizeof(double));
+    assert(seconds != NULL);
+    for (int i = 0; i < numQueries; i++) {
+      fwrite(queries[i].answer, 1, queries[i].length, out);
+      free(queries[i].answer);
+      seconds[i] = queries[i].seconds;
+    }
+    if (fclose(out) != 0)
+      fprintf(stderr, "Couldn't write results to \"%s\".\n", resultsFile);
+    qsort(seconds, numQueries, sizeof(double), CompareSeconds);
+    // nearest rank: the smallest latency at least p% of the queries are within
+    double p50 = (numQueries > 0) ? seconds[(numQueries * 50 + 99) / 100 - 1] : 0;
+    double p99 = (numQueries > 0) ? seconds[(numQueries * 99 + 99) / 100 - 1] : 0;
+    printf("Answered %d quer%s in %.3f seconds on %ld thread%s: %.0f queries/sec, "
+           "latency p50 %.3f ms, p99 %.3f ms.\n", numQueries,
+           (numQueries == 1) ? "y" : "ies", elapsed, numThreads,
+           (numThreads == 1) ? "" : "s", (elapsed > 0) ? numQueries / elapsed : 0,
+           p50 * 1e3, p99 * 1e3);
+    printf("Results are in \"%s\".\n", resultsFile);
+    free(seconds);
+  }
+  free(resultsFile);
+  free(queries);
+  free(gBatchQueries);
+  gBatchQueries = NULL;
+}
+
 /**
  * Function: ProcessResponse
  * -------------------------
@@ -517,7 +874,7 @@ static void QueryIndices() {
  */
 
 static void ProcessResponse(const char *word) {
-  if (!WordIsWellFormed(word)) {
+  if (!WordIsWellFormed(word, strlen(word))) {
     printf("\tWe won't be allowing words like \"%s\" into our set of indices.\n",
            word);
     return;
@@ -544,12 +901,13 @@ static void ProcessResponse(const char *word) {
     result_t *r = (result_t *)VectorNth(&results, i);
     const char *title = IndexGetArticleTitle(gIndex, r->article_id);
     const char *url = IndexGetArticleURL(gIndex, r->article_id);
+    char note[32];
     if (r->count == 1) {
-      printf("%d.) \"%s\" [search term occurs %d time]\n", i + 1, 
-             title ? title : "(no title)", r->count);
+      printf("%d.) \"%s\" [search term occurs %d time%s]\n", i + 1, 
+             title ? title : "(no title)", r->count, ScoreNote(r, note, sizeof(note)));
     } else {
-      printf("%d.) \"%s\" [search term occurs %d times]\n", i + 1, 
-             title ? title : "(no title)", r->count);
+      printf("%d.) \"%s\" [search term occurs %d times%s]\n", i + 1, 
+             title ? title : "(no title)", r->count, ScoreNote(r, note, sizeof(note)));
     }
     printf("\"%s\"\n", url ? url : "(no url)");
   }
@@ -557,6 +915,55 @@ static void ProcessResponse(const char *word) {
   VectorDispose(&results);
 }
 
+/**
+ * Function: ProcessQuery
+ * ----------------------
+ * Lists up to 10 articles matching a multi-word query such as
+ * "climate AND policy" or "rocket NOT launch", best first, where an
+ * article's relevance is the total number of times the words that
+ * matched occur in it (or their summed BM25 scores, under -r bm25).  Stop
+ * words in the query are quietly ignored.
+ */
+
+static void ProcessQuery(const char *text) {
+  vector results;
+  const char *error;
+  int found = IndexQuery(gIndex, text, 10, &results, &error);
+
+  if (found < 0) {
+    printf("\tCouldn't make sense of \"%s\": %s\n", text, error);
+  } else if (found == 0) {
+    printf("None of today's news articles match \"%s\".\n", text);
+  }
+
+  for (int i = 0; i < found; i++) {
+    result_t *r = (result_t *)VectorNth(&results, i);
+    const char *title = IndexGetArticleTitle(gIndex, r->article_id);
+    const char *url = IndexGetArticleURL(gIndex, r->article_id);
+    char note[32];
+    printf("%d.) \"%s\" [search terms occur %d time%s%s]\n", i + 1,
+           title ? title : "(no title)", r->count, (r->count == 1) ? "" : "s",
+           ScoreNote(r, note, sizeof(note)));
+    printf("\"%s\"\n", url ? url : "(no url)");
+  }
+
+  VectorDispose(&results);
+}
+
+/**
+ * Function: ScoreNote
+ * -------------------
+ * Returns what to add to a result's occurrence count when results aren't
+ * ranked by that count alone: ", BM25 score 7.42" under -r bm25, and ""
+ * otherwise.  The note is written into buffer when there is one.
+ */
+
+static const char *ScoreNote(const result_t *r, char buffer[], size_t size) {
+  if (gRanking != kRankByBM25) return "";
+  snprintf(buffer, size, ", BM25 score %.2f", r->score);
+  return buffer;
+}
+
 /**
  * Predicate Function: WordIsWellFormed
  * ------------------------------------
@@ -568,15 +975,15 @@ static void ProcessResponse(const char *word) {
  * or the '-' character.
  */
 
-static bool WordIsWellFormed(const char *word) {
-  int i;
-  if (strlen(word) == 0)
+static bool WordIsWellFormed(const char *word, size_t length) {
+  size_t i;
+  if (length == 0)
     return true;
   if (!isalpha((int)word[0]))
     return false;
-  for (i = 1; i < strlen(word); i++)
+  for (i = 1; i < length; i++)
     if (!isalnum((int)word[i]) && (word[i] != '-'))
       return false;
 
   return true;
-}
\ No newline at end of file
+}
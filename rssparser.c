@@ -0,0 +1,192 @@
+/* rssparser.c
+ *
+ * A byte-at-a-time state machine, except where it can skip ahead: text is
+ * scanned for the next '<' with memchr, CDATA sections for the next ']' and
+ * comments for the next '-', so almost every byte of a feed is looked at
+ * only by memchr.  Nothing ever has to be held over from one piece of the
+ * feed to the next except the tag being read (up to kMaxRSSTagLength
+ * characters of it) and how much of a closing "]]>" or "-->" has been
+ * seen.
+ */
+
+#include "html-utils.h"   /* first: bool.h must precede stdbool.h */
+#include "rssparser.h"
+#include <string.h>
+#include <ctype.h>
+#include <strings.h>
+
+enum { kText, kTag, kCData, kComment };
+enum { kTitle, kLink, kDescription };
+
+static const char *const kFieldNames[] = { "title", "link", "description" };
+static const char *const kItemName = "item";
+static const char *const kCDataOpener = "![CDATA[";   /* after the '<' */
+static const char *const kCommentOpener = "!--";
+
+void RSSParserNew(rssparser *p, RSSItemFunction emit, void *aux) {
+    p->state = kText;
+    p->matched = 0;
+    p->tagLength = 0;
+    p->tagLast = '\0';
+    p->inItem = false;
+    p->capturing = -1;
+    for (int i = 0; i < 3; i++) p->fieldLengths[i] = 0;
+    p->emit = emit;
+    p->aux = aux;
+}
+
+/* Adds text to the field being read, if any */
+static void Append(rssparser *p, const char *text, size_t length) {
+    if (p->capturing < 0) return;
+    int *used = &p->fieldLengths[p->capturing];
+    size_t room = kMaxRSSFieldLength - *used;
+    if (length > room) length = room;
+    memcpy(p->fields[p->capturing] + *used, text, length);
+    *used += length;
+}
+
+/* Finishes a field in place, returning where its text now starts */
+static const char *Trim(char *field, int length) {
+    while (length > 0 && isspace((unsigned char)field[length - 1])) length--;
+    field[length] = '\0';
+    while (isspace((unsigned char)*field)) field++;
+    RemoveEscapeCharacters(field);
+    return field;
+}
+
+static void Emit(rssparser *p) {
+    rssitem item;
+    item.title = Trim(p->fields[kTitle], p->fieldLengths[kTitle]);
+    item.link = Trim(p->fields[kLink], p->fieldLengths[kLink]);
+    item.description = Trim(p->fields[kDescription], p->fieldLengths[kDescription]);
+    p->emit(&item, p->aux);
+}
+
+static bool NameIs(const char *name, size_t length, const char *expected) {
+    return length == strlen(expected) && strncasecmp(name, expected, length) == 0;
+}
+
+/* Acts on the tag just read: <item> and </item> delimit items, and inside
+ * one, the text between <title> and </title> (say) is that field's */
+static void HandleTag(rssparser *p) {
+    const char *name = p->tag;
+    size_t length = p->tagLength;
+    bool closing = length > 0 && name[0] == '/';
+    if (closing) {
+        name++;
+        length--;
+    }
+    size_t nameLength = strcspn(name, " \t\r\n/");
+    if (nameLength > length) nameLength = length;
+    bool empty = !closing && p->tagLast == '/';   /* <link/> */
+
+    if (NameIs(name, nameLength, kItemName)) {
+        if (closing && p->inItem) Emit(p);
+        p->inItem = !closing && !empty;
+        p->capturing = -1;
+        for (int i = 0; i < 3; i++) p->fieldLengths[i] = 0;
+        return;
+    }
+    if (!p->inItem) return;
+    for (int i = 0; i < 3; i++) {
+        if (!NameIs(name, nameLength, kFieldNames[i])) continue;
+        if (closing && p->capturing == i) {
+            p->capturing = -1;
+        } else if (!closing && !empty && p->capturing < 0) {
+            p->capturing = i;
+            p->fieldLengths[i] = 0;   /* a repeated element replaces the first */
+        }
+        return;
+    }
+}
+
+/* Consumes bytes of a tag up to its '>', watching for the start of a CDATA
+ * section or comment, which aren't tags and can contain '>' */
+static const char *ReadTag(rssparser *p, const char *bytes, const char *end) {
+    while (bytes < end) {
+        char ch = *bytes++;
+        if (ch == '>') {
+            p->tag[p->tagLength] = '\0';
+            HandleTag(p);
+            p->state = kText;
+            return bytes;
+        }
+        if (p->tagLength < kMaxRSSTagLength) p->tag[p->tagLength++] = ch;
+        p->tagLast = ch;
+        if (p->tagLength == (int)strlen(kCommentOpener) &&
+            memcmp(p->tag, kCommentOpener, p->tagLength) == 0) {
+            p->state = kComment;
+            p->matched = 0;
+            return bytes;
+        }
+        if (p->tagLength == (int)strlen(kCDataOpener) &&
+            strncasecmp(p->tag, kCDataOpener, p->tagLength) == 0) {
+            p->state = kCData;
+            p->matched = 0;
+            return bytes;
+        }
+    }
+    return bytes;
+}
+
+/* Consumes a CDATA section up to and including its "]]>", or a comment up
+ * to its "-->".  CDATA text belongs to the field being read */
+static const char *ReadSection(rssparser *p, const char *bytes, const char *end,
+                               char closer, bool keep) {
+    static const char kClosers[2] = "]]";
+    while (bytes < end) {
+        if (p->matched == 0) {
+            const char *hit = memchr(bytes, closer, end - bytes);
+            if (hit == NULL) hit = end;
+            if (keep) Append(p, bytes, hit - bytes);
+            if (hit == end) return end;
+            bytes = hit + 1;
+            p->matched = 1;
+            continue;
+        }
+        char ch = *bytes++;
+        if (ch == closer) {
+            if (p->matched == 2 && keep) Append(p, kClosers, 1);   /* "]]]>" */
+            p->matched = 2;
+        } else if (ch == '>' && p->matched == 2) {
+            p->matched = 0;
+            p->state = kText;
+            return bytes;
+        } else {
+            if (keep) {
+                Append(p, kClosers, p->matched);
+                Append(p, &ch, 1);
+            }
+            p->matched = 0;
+        }
+    }
+    return bytes;
+}
+
+void RSSParserFeed(rssparser *p, const char *bytes, size_t length) {
+    const char *end = bytes + length;
+    while (bytes < end) {
+        switch (p->state) {
+        case kText: {
+            const char *open = memchr(bytes, '<', end - bytes);
+            if (open == NULL) open = end;
+            Append(p, bytes, open - bytes);
+            if (open == end) return;
+            bytes = open + 1;
+            p->state = kTag;
+            p->tagLength = 0;
+            p->tagLast = '\0';
+            break;
+        }
+        case kTag:
+            bytes = ReadTag(p, bytes, end);
+            break;
+        case kCData:
+            bytes = ReadSection(p, bytes, end, ']', true);
+            break;
+        case kComment:
+            bytes = ReadSection(p, bytes, end, '-', false);
+            break;
+        }
+    }
+}
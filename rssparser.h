@@ -0,0 +1,79 @@
+#ifndef _rssparser_
+#define _rssparser_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Type: rssitem
+ * -------------
+ * One news item of an RSS feed: the text of its <title>, <link> and
+ * <description> elements, with CDATA sections unwrapped, markup nested
+ * inside them dropped, surrounding white space trimmed and HTML escapes
+ * decoded.  Missing elements come back as empty strings, and text longer
+ * than kMaxRSSFieldLength is cut short.  The strings belong to the parser
+ * and are only valid during the call that hands the item over.
+ */
+
+enum { kMaxRSSFieldLength = 1023 };
+
+typedef struct {
+    const char *title;
+    const char *link;
+    const char *description;
+} rssitem;
+
+typedef void (*RSSItemFunction)(const rssitem *item, void *aux);
+
+/**
+ * Type: rssparser
+ * ---------------
+ * A push parser for RSS feeds: it's handed a feed a piece at a time, as
+ * the bytes come off the network, and hands back each <item> the moment
+ * its </item> arrives, however the feed happens to be split into pieces.
+ * It understands just enough XML for that: tags, CDATA sections and
+ * comments.  Pretend the fields are private.
+ *
+ *     rssparser p;
+ *     RSSParserNew(&p, PrintItem, NULL);
+ *     while ((n = read(fd, buffer, sizeof(buffer))) > 0)
+ *         RSSParserFeed(&p, buffer, n);
+ *
+ * There's nothing to dispose of.  An item still open at the end of the
+ * feed is dropped.
+ */
+
+enum { kMaxRSSTagLength = 63 };   /* enough for any name we look for */
+
+typedef struct {
+    int state;
+    int matched;                  /* how much of "]]>" or "-->" we've seen */
+    char tag[kMaxRSSTagLength + 1];
+    int tagLength;
+    char tagLast;                 /* last character before the '>' */
+    bool inItem;
+    int capturing;                /* field being read, or -1 */
+    char fields[3][kMaxRSSFieldLength + 1];
+    int fieldLengths[3];
+    RSSItemFunction emit;
+    void *aux;
+} rssparser;
+
+/**
+ * Function: RSSParserNew
+ * ----------------------
+ * Initializes p to pass every item it finds, along with aux, to emit.
+ */
+
+void RSSParserNew(rssparser *p, RSSItemFunction emit, void *aux);
+
+/**
+ * Function: RSSParserFeed
+ * -----------------------
+ * Parses the next length bytes of the feed, calling the emit function for
+ * every item they complete.
+ */
+
+void RSSParserFeed(rssparser *p, const char *bytes, size_t length);
+
+#endif
@@ -0,0 +1,139 @@
+/* snapshot-test.c
+ *
+ * Checks that a term dictionary saved by TermDictSave maps back with every
+ * term at its id, and that TermDictMap turns down images whose contents
+ * would lead a lookup astray: an id out of range, an id filed in two slots,
+ * a table with no empty slot to end a probe, a term starting past the
+ * arena, and an image cut short.  Every index snapshot (-l, -u) maps its
+ * dictionaries this way, so a damaged file must fail to load rather than
+ * crash the first query.
+ *
+ *   ./snapshot-test
+ */
+
+#define _XOPEN_SOURCE 700
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "termdict.h"
+
+static const int kNumTerms = 300;
+
+static int gFailures = 0;
+
+static void Check(bool ok, const char *what) {
+  if (!ok) {
+    printf("FAIL: %s\n", what);
+    gFailures++;
+  }
+}
+
+static void TermName(int i, char *buffer, size_t size) {
+  snprintf(buffer, size, "term%d", i);
+}
+
+/* Saves td and reads the image back into memory (malloc aligns it to 8) */
+static char *SaveImage(const termdict *td, size_t *size) {
+  FILE *f = tmpfile();
+  assert(f != NULL);
+  *size = TermDictSave(td, f);
+  assert(*size > 0);
+  char *image = malloc(*size);
+  assert(image != NULL);
+  rewind(f);
+  size_t n = fread(image, 1, *size, f);
+  assert(n == *size);
+  fclose(f);
+  return image;
+}
+
+/* Where the parts of an image lie, found by mapping it once */
+typedef struct {
+  size_t slots, offsets;
+  int capacity;
+} layout;
+
+static char *Copy(const char *image, size_t size) {
+  char *copy = malloc(size);
+  assert(copy != NULL);
+  memcpy(copy, image, size);
+  return copy;
+}
+
+static bool Maps(char *image, size_t size) {
+  termdict td;
+  bool mapped = TermDictMap(&td, image, size);
+  if (mapped) TermDictDispose(&td);
+  free(image);
+  return mapped;
+}
+
+static int OccupiedSlot(const termslot *slots, int capacity, int nth) {
+  for (int i = 0; i < capacity; i++)
+    if (slots[i].id >= 0 && nth-- == 0) return i;
+  return -1;
+}
+
+int main(void) {
+  termdict built;
+  TermDictNew(&built, 16);
+  char term[32];
+  for (int i = 0; i < kNumTerms; i++) {
+    bool added;
+    TermName(i, term, sizeof(term));
+    TermDictIntern(&built, term, strlen(term), &added);
+  }
+  size_t size;
+  char *image = SaveImage(&built, &size);
+  TermDictDispose(&built);
+
+  termdict td;
+  bool mapped = TermDictMap(&td, image, size);
+  Check(mapped, "a saved dictionary should map");
+  if (!mapped) return 1;
+  int found = 0;
+  for (int i = 0; i < kNumTerms; i++) {
+    TermName(i, term, sizeof(term));
+    found += (TermDictLookup(&td, term, strlen(term)) == i);
+  }
+  Check(found == kNumTerms, "every term should map back to its id");
+  Check(TermDictLookup(&td, "absent", 6) == -1, "an absent term shouldn't be found");
+  layout at = { (char *)td.table->slots - image, (char *)td.offsets - image,
+                td.table->capacity };
+  TermDictDispose(&td);
+
+  char *bad = Copy(image, size);
+  termslot *slots = (termslot *)(bad + at.slots);
+  slots[OccupiedSlot(slots, at.capacity, 0)].id = kNumTerms;
+  Check(!Maps(bad, size), "an id past the last term should be refused");
+
+  bad = Copy(image, size);
+  slots = (termslot *)(bad + at.slots);
+  slots[OccupiedSlot(slots, at.capacity, 1)].id =
+    slots[OccupiedSlot(slots, at.capacity, 0)].id;
+  Check(!Maps(bad, size), "an id in two slots should be refused");
+
+  bad = Copy(image, size);
+  slots = (termslot *)(bad + at.slots);
+  for (int i = 0; i < at.capacity; i++)
+    if (slots[i].id < 0) slots[i].id = 0;
+  Check(!Maps(bad, size), "a table with no empty slot should be refused");
+
+  bad = Copy(image, size);
+  slots = (termslot *)(bad + at.slots);
+  slots[OccupiedSlot(slots, at.capacity, 0)].id = -1;
+  Check(!Maps(bad, size), "a table missing a term should be refused");
+
+  bad = Copy(image, size);
+  ((uint32_t *)(bad + at.offsets))[kNumTerms - 1] = (uint32_t)(size - at.offsets);
+  Check(!Maps(bad, size), "a term starting past the arena should be refused");
+
+  Check(!Maps(Copy(image, size), size - 8), "a truncated image should be refused");
+  free(image);
+
+  if (gFailures > 0) return 1;
+  printf("PASS: term dictionary snapshots\n");
+  return 0;
+}
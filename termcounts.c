@@ -0,0 +1,88 @@
+/* termcounts.c
+ *
+ * Linear probing over a power-of-two array that doubles once it's half
+ * full.  Each slot caches its term's full hash, so probes compare the
+ * terms themselves only when both hash and length already match.
+ */
+
+#include "termcounts.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <assert.h>
+
+static const int kMinCapacity = 64;
+
+/* FNV-1a over the lowercased bytes */
+static uint32_t TermHash(const char *term, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)tolower((unsigned char)term[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void AllocateSlots(termcounts *tc, int capacity) {
+    tc->slots = calloc(capacity, sizeof(termcount));
+    assert(tc->slots != NULL);
+    tc->capacity = capacity;
+}
+
+void TermCountsNew(termcounts *tc, int expectedTerms) {
+    int capacity = kMinCapacity;
+    while (capacity < 2 * expectedTerms) capacity *= 2;
+    AllocateSlots(tc, capacity);
+    tc->numTerms = 0;
+}
+
+void TermCountsDispose(termcounts *tc) {
+    free(tc->slots);
+    tc->slots = NULL;
+}
+
+static void Grow(termcounts *tc) {
+    termcount *old = tc->slots;
+    int oldCapacity = tc->capacity;
+    AllocateSlots(tc, 2 * oldCapacity);
+    int mask = tc->capacity - 1;
+    for (int i = 0; i < oldCapacity; i++) {
+        if (old[i].count == 0) continue;
+        int slot = old[i].hash & mask;
+        while (tc->slots[slot].count != 0) slot = (slot + 1) & mask;
+        tc->slots[slot] = old[i];
+    }
+    free(old);
+}
+
+void TermCountsAdd(termcounts *tc, const char *term, size_t length) {
+    uint32_t hash = TermHash(term, length);
+    int mask = tc->capacity - 1;
+    for (int slot = hash & mask;; slot = (slot + 1) & mask) {
+        termcount *e = &tc->slots[slot];
+        if (e->count == 0) {
+            e->term = term;
+            e->length = (uint32_t)length;
+            e->hash = hash;
+            e->count = 1;
+            if (++tc->numTerms * 2 > tc->capacity) Grow(tc);
+            return;
+        }
+        if (e->hash == hash && e->length == length &&
+            strncasecmp(e->term, term, length) == 0) {
+            e->count++;
+            return;
+        }
+    }
+}
+
+int TermCountsSize(const termcounts *tc) {
+    return tc->numTerms;
+}
+
+void TermCountsMap(const termcounts *tc, TermCountsMapFunction mapfn, void *auxData) {
+    for (int i = 0; i < tc->capacity; i++) {
+        if (tc->slots[i].count != 0) mapfn(&tc->slots[i], auxData);
+    }
+}
@@ -0,0 +1,79 @@
+#ifndef _termcounts_
+#define _termcounts_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Type: termcounts
+ * ----------------
+ * A small open-addressing table that counts how often each distinct term
+ * occurs in one article.  A worker fills one privately while scanning the
+ * article, and then merges it into the shared index with a single update
+ * per distinct term rather than one per occurrence.
+ *
+ * Terms are compared without regard to case.  The table doesn't copy them:
+ * each entry refers to the term's first occurrence, which must stay put
+ * (and unmodified) until the table is disposed of.
+ *
+ * As with vector and hashset, the fields are exposed only so a termcounts
+ * can live on the stack; pretend they're private.
+ */
+
+typedef struct {
+  const char *term;   /* first occurrence; not '\0'-terminated */
+  uint32_t length;
+  uint32_t hash;
+  int count;          /* 0 marks an empty slot */
+} termcount;
+
+typedef struct {
+  termcount *slots;
+  int capacity;       /* always a power of two */
+  int numTerms;
+} termcounts;
+
+/**
+ * Function: TermCountsNew
+ * -----------------------
+ * Initializes an empty table with room for about expectedTerms distinct
+ * terms before it needs to grow.
+ */
+
+void TermCountsNew(termcounts *tc, int expectedTerms);
+
+/**
+ * Function: TermCountsDispose
+ * ---------------------------
+ * Releases the table's storage.  The terms themselves were never owned.
+ */
+
+void TermCountsDispose(termcounts *tc);
+
+/**
+ * Function: TermCountsAdd
+ * -----------------------
+ * Records one more occurrence of the length bytes at term.
+ */
+
+void TermCountsAdd(termcounts *tc, const char *term, size_t length);
+
+/**
+ * Function: TermCountsSize
+ * ------------------------
+ * Returns the number of distinct terms recorded so far.
+ */
+
+int TermCountsSize(const termcounts *tc);
+
+/**
+ * Function: TermCountsMap
+ * -----------------------
+ * Calls mapfn once for every distinct term, in no particular order, with
+ * the address of its entry and the client's auxData.
+ */
+
+typedef void (*TermCountsMapFunction)(const termcount *entry, void *auxData);
+void TermCountsMap(const termcounts *tc, TermCountsMapFunction mapfn, void *auxData);
+
+#endif
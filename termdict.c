@@ -0,0 +1,291 @@
+/* termdict.c
+ *
+ * Linear probing over a power-of-two slot array that doubles once it's half
+ * full; rehashing only moves the (hash, id) pairs, since the cached hashes
+ * make it unnecessary to touch the arena.  The arena and the id array grow
+ * by doubling too, always into fresh copies, since lookups on other threads
+ * may still be using the old ones.
+ */
+
+#include "termdict.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <limits.h>
+
+static const int kMinCapacity = 1024;
+static const size_t kMinArenaSize = 16 * 1024;
+
+/* FNV-1a */
+uint32_t TermDictHash(const char *term, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)term[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static termtable *NewTable(int capacity) {
+    termtable *t = malloc(sizeof(termtable));
+    assert(t != NULL);
+    t->slots = malloc(capacity * sizeof(termslot));
+    assert(t->slots != NULL);
+    for (int i = 0; i < capacity; i++) t->slots[i].id = -1;
+    t->capacity = capacity;
+    return t;
+}
+
+void TermDictNew(termdict *td, int expectedTerms) {
+    int capacity = kMinCapacity;
+    while (capacity < 2 * expectedTerms) capacity *= 2;
+    td->table = NewTable(capacity);
+    td->numTerms = 0;
+
+    td->offsetsAllocated = capacity / 2;
+    td->offsets = malloc(td->offsetsAllocated * sizeof(uint32_t));
+    assert(td->offsets != NULL);
+
+    td->arenaAllocated = kMinArenaSize;
+    td->arena = malloc(td->arenaAllocated);
+    assert(td->arena != NULL);
+    td->arenaLength = 0;
+}
+
+void TermDictDispose(termdict *td) {
+    if (td->offsetsAllocated > 0) {   /* otherwise mapped */
+        free(td->table->slots);
+        free(td->offsets);
+        free(td->arena);
+    }
+    free(td->table);
+}
+
+/* Lookups may run alongside TermDictInternShared, so a slot's id is loaded
+   before its hash, and the offsets and arena only after the id that leads
+   to them */
+static bool SlotMatches(const termdict *td, const termslot *s, uint32_t hash,
+                        const char *term, size_t length) {
+    int id = __atomic_load_n(&s->id, __ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&s->hash, __ATOMIC_RELAXED) != hash) return false;
+    const uint32_t *offsets = __atomic_load_n(&td->offsets, __ATOMIC_ACQUIRE);
+    const char *stored = __atomic_load_n(&td->arena, __ATOMIC_ACQUIRE) + offsets[id];
+    /* strnlen first, so that nothing past a shorter term's NUL is read */
+    return strnlen(stored, length + 1) == length && memcmp(stored, term, length) == 0;
+}
+
+/* Returns the slot of t holding term, or the empty slot where it belongs */
+static termslot *FindSlot(const termdict *td, const termtable *t, uint32_t hash,
+                          const char *term, size_t length) {
+    int mask = t->capacity - 1;
+    for (int i = hash & mask;; i = (i + 1) & mask) {
+        termslot *s = &t->slots[i];
+        if (__atomic_load_n(&s->id, __ATOMIC_ACQUIRE) < 0 ||
+            SlotMatches(td, s, hash, term, length))
+            return s;
+    }
+}
+
+int TermDictLookup(const termdict *td, const char *term, size_t length) {
+    const termtable *t = __atomic_load_n(&td->table, __ATOMIC_ACQUIRE);
+    termslot *s = FindSlot(td, t, TermDictHash(term, length), term, length);
+    return __atomic_load_n(&s->id, __ATOMIC_ACQUIRE);
+}
+
+/* Copies n bytes of old into a fresh allocation of size bytes */
+static void *Grown(const void *old, size_t n, size_t size) {
+    void *fresh = malloc(size);
+    assert(fresh != NULL);
+    if (n > 0) memcpy(fresh, old, n);
+    return fresh;
+}
+
+static void Rehash(termdict *td, epoch *reclaim) {
+    termtable *old = td->table;
+    termtable *t = NewTable(2 * old->capacity);
+    int mask = t->capacity - 1;
+    for (int i = 0; i < old->capacity; i++) {
+        if (old->slots[i].id < 0) continue;
+        int j = old->slots[i].hash & mask;
+        while (t->slots[j].id >= 0) j = (j + 1) & mask;
+        t->slots[j] = old->slots[i];
+    }
+    __atomic_store_n(&td->table, t, __ATOMIC_RELEASE);
+    EpochRetire(reclaim, old->slots);
+    EpochRetire(reclaim, old);
+}
+
+static uint32_t AppendToArena(termdict *td, const char *term, size_t length,
+                              epoch *reclaim) {
+    if (td->arenaLength + length + 1 > td->arenaAllocated) {
+        while (td->arenaLength + length + 1 > td->arenaAllocated)
+            td->arenaAllocated *= 2;
+        char *old = td->arena;
+        __atomic_store_n(&td->arena, Grown(old, td->arenaLength, td->arenaAllocated),
+                         __ATOMIC_RELEASE);
+        EpochRetire(reclaim, old);
+    }
+    size_t offset = td->arenaLength;
+    assert(offset <= UINT32_MAX);
+    memcpy(td->arena + offset, term, length);
+    td->arena[offset + length] = '\0';
+    td->arenaLength += length + 1;
+    return (uint32_t)offset;
+}
+
+/* Copies a mapped dictionary's arrays into memory it owns and can grow.
+   The mapped ones belong to the snapshot and are left alone */
+static void TakeOwnership(termdict *td, epoch *reclaim) {
+    termtable *old = td->table;
+    termtable *t = malloc(sizeof(termtable));
+    assert(t != NULL);
+    t->capacity = old->capacity;
+    t->slots = Grown(old->slots, t->capacity * sizeof(termslot),
+                     t->capacity * sizeof(termslot));
+    td->offsetsAllocated = t->capacity / 2;
+    uint32_t *offsets = Grown(td->offsets, td->numTerms * sizeof(uint32_t),
+                              td->offsetsAllocated * sizeof(uint32_t));
+    td->arenaAllocated = (td->arenaLength > kMinArenaSize) ? td->arenaLength : kMinArenaSize;
+    char *arena = Grown(td->arena, td->arenaLength, td->arenaAllocated);
+
+    __atomic_store_n(&td->offsets, offsets, __ATOMIC_RELEASE);
+    __atomic_store_n(&td->arena, arena, __ATOMIC_RELEASE);
+    __atomic_store_n(&td->table, t, __ATOMIC_RELEASE);
+    EpochRetire(reclaim, old);
+}
+
+int TermDictIntern(termdict *td, const char *term, size_t length, bool *added) {
+    return TermDictInternShared(td, term, length, added, NULL);
+}
+
+int TermDictInternShared(termdict *td, const char *term, size_t length,
+                         bool *added, epoch *reclaim) {
+    uint32_t hash = TermDictHash(term, length);
+    termslot *s = FindSlot(td, td->table, hash, term, length);
+    if (s->id >= 0) {
+        *added = false;
+        return s->id;
+    }
+    if (td->offsetsAllocated == 0) {
+        TakeOwnership(td, reclaim);
+        s = FindSlot(td, td->table, hash, term, length);
+    }
+
+    if (td->numTerms == td->offsetsAllocated) {
+        uint32_t *old = td->offsets;
+        td->offsetsAllocated *= 2;
+        __atomic_store_n(&td->offsets,
+                         Grown(old, td->numTerms * sizeof(uint32_t),
+                               td->offsetsAllocated * sizeof(uint32_t)),
+                         __ATOMIC_RELEASE);
+        EpochRetire(reclaim, old);
+    }
+    int id = td->numTerms++;
+    td->offsets[id] = AppendToArena(td, term, length, reclaim);
+    __atomic_store_n(&s->hash, hash, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->id, id, __ATOMIC_RELEASE);
+    if (td->numTerms * 2 > td->table->capacity) Rehash(td, reclaim);
+
+    *added = true;
+    return id;
+}
+
+const char *TermDictTerm(const termdict *td, int id) {
+    assert(id >= 0);
+    const uint32_t *offsets = __atomic_load_n(&td->offsets, __ATOMIC_ACQUIRE);
+    return __atomic_load_n(&td->arena, __ATOMIC_ACQUIRE) + offsets[id];
+}
+
+int TermDictSize(const termdict *td) {
+    return td->numTerms;
+}
+
+/* Images are this header, the slots, the id array and the arena, the last
+   two padded to 8 bytes so that every part stays aligned */
+typedef struct {
+    uint32_t capacity;
+    int32_t numTerms;
+    uint64_t arenaLength;
+} termdictheader;
+
+static const char kPadding[8];
+
+static uint64_t Padded(uint64_t size) {
+    return (size + 7) & ~(uint64_t)7;
+}
+
+size_t TermDictSave(const termdict *td, FILE *out) {
+    const termtable *t = td->table;
+    termdictheader header = { (uint32_t)t->capacity, td->numTerms, td->arenaLength };
+    size_t offsetsSize = td->numTerms * sizeof(uint32_t);
+    size_t offsetsPadding = Padded(offsetsSize) - offsetsSize;
+    size_t arenaPadding = Padded(td->arenaLength) - td->arenaLength;
+    if (fwrite(&header, sizeof(header), 1, out) != 1 ||
+        fwrite(t->slots, sizeof(termslot), t->capacity, out) != (size_t)t->capacity ||
+        fwrite(td->offsets, 1, offsetsSize, out) != offsetsSize ||
+        fwrite(kPadding, 1, offsetsPadding, out) != offsetsPadding ||
+        fwrite(td->arena, 1, td->arenaLength, out) != td->arenaLength ||
+        fwrite(kPadding, 1, arenaPadding, out) != arenaPadding)
+        return 0;
+    return sizeof(header) + t->capacity * sizeof(termslot) + offsetsSize +
+           offsetsPadding + td->arenaLength + arenaPadding;
+}
+
+/* Lookups trust what they find: each id must be in range and in exactly
+   one slot, which (since terms fill at most half the slots) leaves an empty
+   slot to end every probe, and each term must start inside the arena */
+static bool ContentsAreSound(const termslot *slots, int capacity,
+                             const uint32_t *offsets, int numTerms,
+                             uint64_t arenaLength) {
+    uint8_t *seen = calloc(numTerms + 1, 1);
+    assert(seen != NULL);
+    int occupied = 0;
+    bool sound = true;
+    for (int i = 0; i < capacity && sound; i++) {
+        int id = slots[i].id;
+        if (id < 0) continue;
+        sound = id < numTerms && !seen[id];
+        if (sound) seen[id] = 1;
+        occupied++;
+    }
+    free(seen);
+    if (!sound || occupied != numTerms) return false;
+    for (int i = 0; i < numTerms; i++)
+        if (offsets[i] >= arenaLength) return false;
+    return true;
+}
+
+bool TermDictMap(termdict *td, const void *image, size_t size) {
+    termdictheader header;
+    if (size < sizeof(header)) return false;
+    memcpy(&header, image, sizeof(header));
+    uint64_t capacity = header.capacity;
+    if (capacity < (uint64_t)kMinCapacity || capacity > INT_MAX ||
+        (capacity & (capacity - 1)) != 0 || header.numTerms < 0 ||
+        2 * (uint64_t)header.numTerms > capacity || header.arenaLength > size)
+        return false;
+
+    uint64_t slotsSize = capacity * sizeof(termslot);
+    uint64_t offsetsSize = Padded((uint64_t)header.numTerms * sizeof(uint32_t));
+    uint64_t arenaSize = Padded(header.arenaLength);
+    if (sizeof(header) + slotsSize + offsetsSize + arenaSize != size) return false;
+    const char *p = (const char *)image + sizeof(header);
+    const char *arena = p + slotsSize + offsetsSize;
+    if (header.arenaLength > 0 && arena[header.arenaLength - 1] != '\0') return false;
+    if (!ContentsAreSound((const termslot *)p, (int)capacity,
+                          (const uint32_t *)(p + slotsSize), header.numTerms,
+                          header.arenaLength))
+        return false;
+
+    td->table = malloc(sizeof(termtable));
+    assert(td->table != NULL);
+    td->table->slots = (termslot *)p;
+    td->table->capacity = (int)capacity;
+    td->numTerms = header.numTerms;
+    td->offsets = (uint32_t *)(p + slotsSize);
+    td->offsetsAllocated = 0;
+    td->arena = (char *)arena;
+    td->arenaLength = header.arenaLength;
+    td->arenaAllocated = 0;
+    return true;
+}
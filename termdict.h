@@ -0,0 +1,152 @@
+#ifndef _termdict_
+#define _termdict_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "epoch.h"
+
+/**
+ * Type: termdict
+ * --------------
+ * Maps each distinct term to a dense integer id (0, 1, 2, ... in order of
+ * first appearance), so per-term data can live in plain arrays indexed by
+ * that id.  The terms themselves are interned back to back in one
+ * contiguous string arena, and the hash table is open-addressed with every
+ * slot caching its term's full hash, so a lookup normally costs one probe
+ * sequence over a flat array and a single string comparison.
+ *
+ * Terms are compared byte for byte; fold case before calling in if it
+ * shouldn't matter.  Pretend the fields are private.  A dictionary mapped
+ * from a snapshot (see TermDictMap) has offsetsAllocated 0, since it owns
+ * none of its arrays.
+ *
+ * One thread may add terms with TermDictInternShared while any number of
+ * others look terms up.  A slot's id is stored last, once the term's text
+ * and offset are in place, and arrays that grow are copied, published and
+ * retired to an epoch rather than resized in place, so a lookup racing an
+ * addition either finds the new term complete or doesn't find it at all.
+ */
+
+typedef struct {
+  uint32_t hash;
+  int32_t id;              /* -1 marks an empty slot */
+} termslot;
+
+typedef struct {
+  termslot *slots;
+  int capacity;            /* always a power of two */
+} termtable;               /* replaced, never changed, when the slots grow */
+
+typedef struct {
+  termtable *table;
+  int numTerms;
+
+  uint32_t *offsets;       /* id -> offset of the term's text in arena */
+  int offsetsAllocated;
+
+  char *arena;             /* '\0'-terminated terms, back to back */
+  size_t arenaLength;
+  size_t arenaAllocated;
+} termdict;
+
+/**
+ * Function: TermDictNew
+ * ---------------------
+ * Initializes an empty dictionary sized for about expectedTerms terms.
+ */
+
+void TermDictNew(termdict *td, int expectedTerms);
+
+/**
+ * Function: TermDictDispose
+ * -------------------------
+ * Releases the table, the id array and the arena.
+ */
+
+void TermDictDispose(termdict *td);
+
+/**
+ * Function: TermDictLookup
+ * ------------------------
+ * Returns the id of the length bytes at term, or -1 if the dictionary
+ * doesn't contain them.
+ */
+
+int TermDictLookup(const termdict *td, const char *term, size_t length);
+
+/**
+ * Function: TermDictIntern
+ * ------------------------
+ * Returns the id of the length bytes at term, adding them (with the next
+ * unused id) if they're new.  *added is set to reflect which happened.
+ */
+
+int TermDictIntern(termdict *td, const char *term, size_t length, bool *added);
+
+/**
+ * Function: TermDictInternShared
+ * ------------------------------
+ * Same as TermDictIntern, for a dictionary other threads may be looking
+ * terms up in meanwhile: arrays it outgrows go to reclaim instead of being
+ * freed, so lookups that entered reclaim before the call can finish with
+ * them.
+ */
+
+int TermDictInternShared(termdict *td, const char *term, size_t length,
+                         bool *added, epoch *reclaim);
+
+/**
+ * Function: TermDictTerm
+ * ----------------------
+ * Returns the '\0'-terminated text of the term with the specified id.  The
+ * pointer is invalidated by the next call to TermDictIntern (or, under
+ * TermDictInternShared, once the caller leaves its epoch).
+ */
+
+const char *TermDictTerm(const termdict *td, int id);
+
+/**
+ * Function: TermDictSave
+ * ----------------------
+ * Writes td's table, id array and arena to out as one image that
+ * TermDictMap can use in place.  Returns the image's size, a multiple of 8,
+ * or 0 if writing failed.
+ */
+
+size_t TermDictSave(const termdict *td, FILE *out);
+
+/**
+ * Function: TermDictMap
+ * ---------------------
+ * Initializes td to look terms up directly in an image written by
+ * TermDictSave, now the size bytes at (8-byte aligned) image, which must
+ * outlive td.  Nothing is copied or rehashed.  The first TermDictIntern that
+ * adds a term copies everything into memory of td's own.  Returns false,
+ * leaving td uninitialized, if the image is malformed, down to an id out of
+ * range or filed twice, a table with no empty slot, or a term that starts
+ * past the arena.
+ */
+
+bool TermDictMap(termdict *td, const void *image, size_t size);
+
+/**
+ * Function: TermDictHash
+ * ----------------------
+ * Returns the hash a dictionary files the length bytes at term under.  The
+ * table is indexed by its low bits, so a client spreading terms over
+ * several dictionaries should choose among them with the high ones.
+ */
+
+uint32_t TermDictHash(const char *term, size_t length);
+
+/**
+ * Function: TermDictSize
+ * ----------------------
+ * Returns the number of terms, which is also one more than the largest id.
+ */
+
+int TermDictSize(const termdict *td);
+
+#endif
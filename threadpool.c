@@ -0,0 +1,122 @@
+/* threadpool.c
+ *
+ * Workers sleep on a condition variable until a task is queued.  The pool
+ * counts tasks that are queued or running, so ThreadPoolWait can return
+ * exactly when that count drops to zero.
+ */
+
+#include "threadpool.h"
+#include <stdlib.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <pthread.h>
+
+typedef struct task {
+    ThreadPoolTaskFunction fn;
+    void *aux;
+    struct task *next;
+} task;
+
+struct threadpool {
+    pthread_t *workers;
+    int numWorkers;
+
+    pthread_mutex_t lock;
+    pthread_cond_t taskReady;   /* signalled when a task is queued or on shutdown */
+    pthread_cond_t allDone;     /* signalled when outstanding drops to zero */
+
+    task *head;
+    task *tail;
+    int outstanding;            /* queued + running */
+    bool shuttingDown;
+};
+
+static void *Worker(void *arg) {
+    threadpool *tp = arg;
+    pthread_mutex_lock(&tp->lock);
+    while (true) {
+        while (tp->head == NULL && !tp->shuttingDown)
+            pthread_cond_wait(&tp->taskReady, &tp->lock);
+        if (tp->head == NULL) break; /* shutting down and nothing left */
+
+        task *t = tp->head;
+        tp->head = t->next;
+        if (tp->head == NULL) tp->tail = NULL;
+        pthread_mutex_unlock(&tp->lock);
+
+        t->fn(t->aux);
+        free(t);
+
+        pthread_mutex_lock(&tp->lock);
+        if (--tp->outstanding == 0) pthread_cond_broadcast(&tp->allDone);
+    }
+    pthread_mutex_unlock(&tp->lock);
+    return NULL;
+}
+
+threadpool *ThreadPoolNew(int numThreads) {
+    if (numThreads <= 0) numThreads = 1;
+
+    threadpool *tp = malloc(sizeof(threadpool));
+    if (!tp) return NULL;
+
+    tp->workers = malloc(numThreads * sizeof(pthread_t));
+    if (!tp->workers) { free(tp); return NULL; }
+
+    pthread_mutex_init(&tp->lock, NULL);
+    pthread_cond_init(&tp->taskReady, NULL);
+    pthread_cond_init(&tp->allDone, NULL);
+    tp->head = tp->tail = NULL;
+    tp->outstanding = 0;
+    tp->shuttingDown = false;
+
+    tp->numWorkers = 0;
+    for (int i = 0; i < numThreads; i++) {
+        if (pthread_create(&tp->workers[i], NULL, Worker, tp) != 0) break;
+        tp->numWorkers++;
+    }
+    assert(tp->numWorkers > 0);
+    return tp;
+}
+
+void ThreadPoolSchedule(threadpool *tp, ThreadPoolTaskFunction fn, void *aux) {
+    assert(tp != NULL && fn != NULL);
+    task *t = malloc(sizeof(task));
+    assert(t != NULL);
+    t->fn = fn;
+    t->aux = aux;
+    t->next = NULL;
+
+    pthread_mutex_lock(&tp->lock);
+    if (tp->tail) tp->tail->next = t; else tp->head = t;
+    tp->tail = t;
+    tp->outstanding++;
+    pthread_cond_signal(&tp->taskReady);
+    pthread_mutex_unlock(&tp->lock);
+}
+
+void ThreadPoolWait(threadpool *tp) {
+    pthread_mutex_lock(&tp->lock);
+    while (tp->outstanding > 0)
+        pthread_cond_wait(&tp->allDone, &tp->lock);
+    pthread_mutex_unlock(&tp->lock);
+}
+
+void ThreadPoolDispose(threadpool *tp) {
+    if (tp == NULL) return;
+    ThreadPoolWait(tp);
+
+    pthread_mutex_lock(&tp->lock);
+    tp->shuttingDown = true;
+    pthread_cond_broadcast(&tp->taskReady);
+    pthread_mutex_unlock(&tp->lock);
+
+    for (int i = 0; i < tp->numWorkers; i++)
+        pthread_join(tp->workers[i], NULL);
+
+    pthread_cond_destroy(&tp->allDone);
+    pthread_cond_destroy(&tp->taskReady);
+    pthread_mutex_destroy(&tp->lock);
+    free(tp->workers);
+    free(tp);
+}
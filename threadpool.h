@@ -0,0 +1,23 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+/* Fixed-size pool of worker threads draining a FIFO of scheduled tasks.
+ * Tasks may schedule further tasks, on this pool or on another one. */
+
+typedef void (*ThreadPoolTaskFunction)(void *aux);
+
+/* Opaque pool structure */
+typedef struct threadpool threadpool;
+
+/* Lifecycle: numThreads <= 0 falls back to a single worker */
+threadpool *ThreadPoolNew(int numThreads);
+void ThreadPoolDispose(threadpool *tp);   /* waits for all tasks first */
+
+/* Queues fn(aux) to run on some worker; never blocks on the task itself */
+void ThreadPoolSchedule(threadpool *tp, ThreadPoolTaskFunction fn, void *aux);
+
+/* Blocks until every scheduled task (including ones scheduled while
+ * waiting) has finished running */
+void ThreadPoolWait(threadpool *tp);
+
+#endif // THREADPOOL_H
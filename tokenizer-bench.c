@@ -0,0 +1,150 @@
+/* tokenizer-bench.c
+ *
+ * Microbenchmark comparing article tokenization through the streamtokenizer
+ * (over fmemopen, as articles used to be read) against the memtokenizer with
+ * each of its scanners.  Every regular file under the corpus directory is
+ * loaded into memory first, so only tokenization is timed.
+ *
+ *   ./tokenizer-bench [-n iterations] [corpus-directory]
+ *
+ * Each run reports the number of words found (tokens other than delimiters)
+ * and their total length, which should agree across all tokenizers.
+ */
+
+#define _XOPEN_SOURCE 700
+#include <assert.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "streamtokenizer.h"
+#include "memtokenizer.h"
+
+static const char *const kTextDelimiters =
+    " \t\n\r\b!@$%^*()_+={[}]|\\'\":;/?.>,<~";
+static const char *const kDefaultCorpus = "data";
+static const int kDefaultIterations = 20;
+
+typedef struct {
+  char *text;
+  size_t length;
+} document;
+
+static document *gCorpus = NULL;
+static int gNumDocuments = 0;
+static size_t gCorpusBytes = 0;
+
+static int LoadDocument(const char *path, const struct stat *sb, int type,
+                        struct FTW *ftw) {
+  if (type != FTW_F || sb->st_size == 0) return 0;
+  FILE *infile = fopen(path, "rb");
+  if (infile == NULL) return 0;
+  document doc;
+  doc.length = sb->st_size;
+  doc.text = malloc(doc.length);
+  assert(doc.text != NULL);
+  doc.length = fread(doc.text, 1, doc.length, infile);
+  fclose(infile);
+
+  gCorpus = realloc(gCorpus, (gNumDocuments + 1) * sizeof(document));
+  assert(gCorpus != NULL);
+  gCorpus[gNumDocuments++] = doc;
+  gCorpusBytes += doc.length;
+  return 0;
+}
+
+typedef struct {
+  long words;
+  long wordBytes;
+} tally;
+
+static void TokenizeWithStreamTokenizer(const document *doc, tally *t) {
+  char word[1024];
+  FILE *infile = fmemopen(doc->text, doc->length, "r");
+  assert(infile != NULL);
+  streamtokenizer st;
+  STNew(&st, infile, kTextDelimiters, false);
+  while (STNextToken(&st, word, sizeof(word))) {
+    size_t length = strlen(word);
+    if (length == 1 && strchr(kTextDelimiters, word[0]) != NULL) continue;
+    t->words++;
+    t->wordBytes += length;
+  }
+  STDispose(&st);
+  fclose(infile);
+}
+
+static delimiterset gArticleDelimiters;
+
+static void TokenizeWithMemTokenizer(const document *doc, tally *t) {
+  memtokenizer mt;
+  slice word;
+  MTNew(&mt, doc->text, doc->length, &gArticleDelimiters);
+  while (MTNextToken(&mt, &word)) {
+    if (word.length == 1 && word.start[0] == '<') continue;
+    t->words++;
+    t->wordBytes += word.length;
+  }
+}
+
+static double Now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void Run(const char *name, void (*tokenize)(const document *, tally *),
+                int iterations) {
+  tally t = {0, 0};
+  double start = Now();
+  for (int i = 0; i < iterations; i++)
+    for (int d = 0; d < gNumDocuments; d++)
+      tokenize(&gCorpus[d], &t);
+  double elapsed = Now() - start;
+
+  double megabytes = (double)gCorpusBytes * iterations / (1024.0 * 1024.0);
+  printf("%-20s %9.1f MB/s  %8.3f s  %ld words, %ld word bytes\n", name,
+         megabytes / elapsed, elapsed, t.words / iterations,
+         t.wordBytes / iterations);
+}
+
+int main(int argc, char **argv) {
+  int iterations = kDefaultIterations;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:")) != -1) {
+    switch (opt) {
+    case 'n': iterations = atoi(optarg); break;
+    default:
+      fprintf(stderr, "Usage: %s [-n iterations] [corpus-directory]\n", argv[0]);
+      return 1;
+    }
+  }
+  const char *corpus = (optind < argc) ? argv[optind] : kDefaultCorpus;
+  if (nftw(corpus, LoadDocument, 16, FTW_PHYS) != 0 || gNumDocuments == 0) {
+    fprintf(stderr, "No documents found under \"%s\".\n", corpus);
+    return 1;
+  }
+  printf("%d documents, %.1f MB, %d iterations\n", gNumDocuments,
+         gCorpusBytes / (1024.0 * 1024.0), iterations);
+
+  DSNew(&gArticleDelimiters, kTextDelimiters, "<");
+  Run("streamtokenizer", TokenizeWithStreamTokenizer, iterations);
+  const char *const kScanners[] = {"scalar", "sse2", "avx2"};
+  for (int i = 0; i < sizeof(kScanners) / sizeof(kScanners[0]); i++) {
+    char name[32];
+    if (MTSelectScanner(kScanners[i]) == NULL) {
+      printf("memtokenizer/%-7s (not supported on this CPU)\n", kScanners[i]);
+      continue;
+    }
+    snprintf(name, sizeof(name), "memtokenizer/%s", kScanners[i]);
+    Run(name, TokenizeWithMemTokenizer, iterations);
+  }
+  MTSelectScanner(NULL);
+
+  for (int d = 0; d < gNumDocuments; d++) free(gCorpus[d].text);
+  free(gCorpus);
+  return 0;
+}
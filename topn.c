@@ -0,0 +1,86 @@
+/* topn.c
+ *
+ * Standard array-backed binary heap.  Ranks compare as in the old full
+ * qsort of IndexQueryTopN (with the score in place of the count), so
+ * results, ties included, come out the same.
+ */
+
+#include "topn.h"
+#include <stdlib.h>
+#include <assert.h>
+
+/* Negative if a ranks ahead of b */
+static int CompareRank(const result_t *a, const result_t *b) {
+    if (a->score != b->score) return (b->score > a->score) ? 1 : -1;
+    return (a->article_id > b->article_id) - (a->article_id < b->article_id);
+}
+
+static int CompareRankFn(const void *a, const void *b) {
+    return CompareRank(a, b);
+}
+
+void TopNNew(topn *t, int capacity) {
+    assert(capacity > 0);
+    t->heap = malloc(capacity * sizeof(result_t));
+    assert(t->heap != NULL);
+    t->size = 0;
+    t->capacity = capacity;
+}
+
+void TopNDispose(topn *t) {
+    free(t->heap);
+    t->heap = NULL;
+}
+
+bool TopNAdmits(const topn *t, const result_t *r) {
+    return t->size < t->capacity || CompareRank(r, &t->heap[0]) < 0;
+}
+
+double TopNThreshold(const topn *t) {
+    return (t->size < t->capacity) ? 0 : t->heap[0].score;
+}
+
+/* The root is the worst result kept: every parent ranks behind its children */
+static void SiftDown(topn *t, int i) {
+    result_t moving = t->heap[i];
+    while (true) {
+        int child = 2 * i + 1;
+        if (child >= t->size) break;
+        if (child + 1 < t->size && CompareRank(&t->heap[child + 1], &t->heap[child]) > 0)
+            child++;
+        if (CompareRank(&t->heap[child], &moving) <= 0) break;
+        t->heap[i] = t->heap[child];
+        i = child;
+    }
+    t->heap[i] = moving;
+}
+
+static void SiftUp(topn *t, int i) {
+    result_t moving = t->heap[i];
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (CompareRank(&t->heap[parent], &moving) >= 0) break;
+        t->heap[i] = t->heap[parent];
+        i = parent;
+    }
+    t->heap[i] = moving;
+}
+
+void TopNOffer(topn *t, const result_t *r) {
+    if (t->size < t->capacity) {
+        t->heap[t->size++] = *r;
+        SiftUp(t, t->size - 1);
+    } else if (CompareRank(r, &t->heap[0]) < 0) {
+        t->heap[0] = *r;
+        SiftDown(t, 0);
+    }
+}
+
+int TopNDrain(topn *t, vector *out) {
+    qsort(t->heap, t->size, sizeof(result_t), CompareRankFn);
+    for (int i = 0; i < t->size; i++)
+        VectorAppend(out, &t->heap[i]);
+    int drained = t->size;
+    t->size = 0;
+    return drained;
+}
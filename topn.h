@@ -0,0 +1,39 @@
+#ifndef _topn_
+#define _topn_
+
+#include "index.h"
+
+/**
+ * Type: topn
+ * ----------
+ * Keeps the best capacity results offered to it, ranked the way queries
+ * rank them: higher score first, smaller article_id breaking ties.  It's a
+ * bounded min-heap with the worst kept result at the root, so offering P
+ * results costs O(P log capacity) time and O(capacity) space, however
+ * large P gets.  Pretend the fields are private.
+ */
+
+typedef struct {
+    result_t *heap;
+    int size;
+    int capacity;
+} topn;
+
+void TopNNew(topn *t, int capacity);
+void TopNDispose(topn *t);
+
+/* Returns true if r would currently make the cut */
+bool TopNAdmits(const topn *t, const result_t *r);
+
+/* Once full, the score a result must beat to make the cut (matching it is
+ * enough only with a smaller article_id than the worst kept); 0 till then */
+double TopNThreshold(const topn *t);
+
+/* Keeps r if it makes the cut, evicting the worst kept result if need be */
+void TopNOffer(topn *t, const result_t *r);
+
+/* Appends the kept results, best first, to the already-initialized out
+ * vector of result_t, and returns how many were appended.  t is left empty. */
+int TopNDrain(topn *t, vector *out);
+
+#endif